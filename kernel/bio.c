@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -23,69 +23,166 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+// Buffers are kept in hash buckets by (dev, blockno), each
+// bucket with its own lock, so lookups of different blocks
+// don't contend. A free buffer (refcnt 0) stays on its
+// bucket, still caching its block, until the clock hand
+// picks it for recycling. b->refcnt, b->used, b->dev,
+// b->blockno and the list links are protected by the lock
+// of b's bucket. bget() never holds two bucket locks.
+#define NBUCKET 31
+
+// most blocks breadahead() starts in one go.
+#define NRABATCH 8
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;   // circular list through prev/next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  uint hand;         // clock hand; advanced atomically
 } bcache;
 
+static int
+bhash(uint dev, uint blockno)
+{
+  return (dev * 131 + blockno) % NBUCKET;
+}
+
+static void
+binsert(struct buf *b, int k)
+{
+  struct buf *head = &bcache.bucket[k].head;
+
+  b->bucket = k;
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
+static void
+bremove(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  b->bucket = -1;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  initlock(&bcache.lock, "bcache");
-
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initticketlock(&bk->lock, "bcache");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+  // spread the empty buffers over the buckets.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->dev = -1;
+    binsert(b, (b - bcache.buf) % NBUCKET);
   }
 }
 
+// Find an unused buffer with the clock algorithm: skip
+// buffers used since the hand last passed, and clear their
+// used bits. Returns it off any bucket, with refcnt 1.
+static struct buf*
+bvictim(void)
+{
+  struct buf *b;
+  struct bucket *bk;
+  int i, k;
+
+  for(i = 0; i < 3*NBUF; i++){
+    b = &bcache.buf[__sync_fetch_and_add(&bcache.hand, 1) % NBUF];
+    if((k = b->bucket) < 0)
+      continue;
+    bk = &bcache.bucket[k];
+    acquire(&bk->lock);
+    if(b->bucket == k && b->refcnt == 0){
+      if(b->used){
+        b->used = 0;
+      } else {
+        bremove(b);
+        b->refcnt = 1;
+        release(&bk->lock);
+        return b;
+      }
+    }
+    release(&bk->lock);
+  }
+  panic("bget: no buffers");
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
-// In either case, return locked buffer.
+// In either case, return locked buffer;
+// except that if ifmissing is set, return 0 if found.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ifmissing)
 {
-  struct buf *b;
+  struct buf *b, *v;
+  struct bucket *bk;
+  int k;
 
-  acquire(&bcache.lock);
+  k = bhash(dev, blockno);
+  bk = &bcache.bucket[k];
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
+      if(ifmissing){
+        release(&bk->lock);
+        return 0;
+      }
       b->refcnt++;
-      release(&bcache.lock);
+      b->used = 1;
+      release(&bk->lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
+  release(&bk->lock);
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
+  // Recycle a buffer that hasn't been used lately.
+  v = bvictim();
+
+  acquire(&bk->lock);
+  // someone else may have cached the block meanwhile.
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      v->dev = -1;
+      v->refcnt = 0;
+      binsert(v, k);
+      if(ifmissing){
+        release(&bk->lock);
+        return 0;
+      }
+      b->refcnt++;
+      b->used = 1;
+      release(&bk->lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
-  panic("bget: no buffers");
+  v->dev = dev;
+  v->blockno = blockno;
+  v->valid = 0;
+  v->used = 1;
+  binsert(v, k);
+  release(&bk->lock);
+  acquiresleep(&v->lock);
+  return v;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +191,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +199,71 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the n blocks in blocknos into the cache,
+// those that aren't there already, without waiting for the
+// disk. Each buffer stays locked until its read finishes
+// and bdone() unlocks it, so a bread() of it meanwhile
+// waits for the data.
+void
+breadahead(uint dev, uint *blocknos, int n)
+{
+  struct buf *b, *bs[NRABATCH];
+  int i, m, k;
+
+  for(i = 0; i < n; i += NRABATCH){
+    m = 0;
+    for(k = i; k < n && k < i+NRABATCH; k++){
+      if((b = bget(dev, blocknos[k], 1)) == 0)
+        continue;
+      if(b->valid)   // lost a race with a bread() of it
+        brelse(b);
+      else
+        bs[m++] = b;
+    }
+    // give up on reads there are no descriptors for.
+    for(k = virtio_disk_start(bs, m, 0, 1); k < m; k++)
+      brelse(bs[k]);
+  }
+}
+
+// Write the n locked bufs in bs to disk, as a batch.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  virtio_disk_start(bs, n, 1, 0);
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
+}
+
+// Drop a reference, with b's sleep-lock already released.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  // b can't change buckets while refcnt > 0.
+  bk = &bcache.bucket[b->bucket];
+  acquire(&bk->lock);
+  b->refcnt--;
+  release(&bk->lock);
+}
+
+// The read that breadahead() started has finished.
+// Called by the disk interrupt, in no process's context,
+// so this can't use brelse()'s check of who holds b.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,7 +274,8 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// It stays cached on its bucket until the clock hand
+// recycles it.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +283,23 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[b->bucket];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[b->bucket];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
-
-
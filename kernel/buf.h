@@ -1,11 +1,15 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int dirty;   // home location older than commit seq? set by logd
+  int seq;     // last log commit that held the block
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  int used;    // referenced since the clock hand last passed?
+  int bucket;  // hash bucket it is on, or -1 while moving
+  struct buf *prev; // hash bucket list
   struct buf *next;
   uchar data[BSIZE];
 };
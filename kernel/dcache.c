@@ -0,0 +1,170 @@
+// Name cache, in front of dirlookup().
+//
+// Each entry records what a name in a directory refers to:
+// the inode number and the offset of its dirent, or, for a
+// negative entry, inum 0 meaning the name is not there.
+// Entries are keyed by (dev, directory inum, name).
+//
+// A directory only changes with its inode locked, and
+// dirlookup() also runs with it locked, so the entries for
+// a directory stay right as long as every change to it goes
+// through dcache_enter(): dirlink() and sys_unlink() do, and
+// iput() purges a directory's entries when it is freed.
+// dcache.lock protects the table itself.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+
+#define NDENTRY 128
+#define NDHASH  61
+
+struct dentry {
+  uint dev;
+  uint dir;          // directory's inum, or 0 if the entry is unused
+  char name[DIRSIZ];
+  uint inum;         // 0 for a negative entry
+  uint off;          // offset of the dirent in dir
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list, least recently used at lru.prev
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  struct dentry lru;
+} dcache;
+
+static int
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 131 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Move d to the most recently used end of the LRU list.
+static void
+dtouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.lru.next;
+  d->prev = &dcache.lru;
+  dcache.lru.next->prev = d;
+  dcache.lru.next = d;
+}
+
+// Take d off its hash chain and mark it unused.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  if(d->dir == 0)
+    return;
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dir = 0;
+}
+
+// Find the entry for name in dir. Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dir, name)]; d; d = d->hnext){
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = &dcache.lru;
+  dcache.lru.next = &dcache.lru;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+// Look name up in directory dir. Returns 1 and sets *inum
+// (0 if name is known to be absent) and *off if the cache
+// knows the answer, 0 if dirlookup() must read the directory.
+int
+dcache_lookup(uint dev, uint dir, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dtouch(d);
+  *inum = d->inum;
+  *off = d->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in dir refers to inum, whose dirent is at
+// off, or with inum 0 that there is no such name.
+void
+dcache_enter(uint dev, uint dir, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  int h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    d = dcache.lru.prev;
+    dunhash(d);
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(dev, dir, name);
+    d->hnext = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget every entry for directory dir, which is being freed.
+void
+dcache_purge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    if(d->dir == dir && d->dev == dev)
+      dunhash(d);
+  }
+  release(&dcache.lock);
+}
@@ -2,39 +2,75 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct kthread;
 struct pipe;
+struct pollhead;
+struct pollwait;
 struct proc;
 struct spinlock;
+struct shm;
 struct sleeplock;
+struct slabcache;
 struct stat;
 struct superblock;
+struct timer;
 struct sigaction;
 struct trapframe;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint*, int);
+void            bwritev(struct buf**, int);
+void            bdone(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
+// cas.S
+int             cas(volatile void*, int, int);
+
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(uint, uint, char*, uint*, uint*);
+void            dcache_enter(uint, uint, char*, uint, uint);
+void            dcache_purge(uint, uint);
+
+// pagecache.c
+void            pagecacheinit(void);
+char*           pagecache_lookup(uint, uint, uint);
+void            pagecache_enter(uint, uint, uint, char*);
+void            pagecache_purge(uint, uint);
+
 // exec.c
 int             exec(char*, char**);
+int             execpagein(pagetable_t, uint64, char**);
 
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+int             filepoll(struct file*, struct pollwait*);
+int             filesend(struct file*, struct file*, uint*, int);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, uint*);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int, uint*);
+struct file*    fdfile(struct proc*, int);
+struct file*    fdget(struct proc*, int, int*);
+int             fdalloc(struct file*);
+struct file*    fdtake(struct proc*, int);
+int             fdcopy(struct proc*, struct proc*);
+void            fdcloseall(struct proc*);
 
 // fs.c
 void            fsinit(int);
@@ -44,6 +80,7 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -63,53 +100,99 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
 void            kfree(void *);
 void            kinit(void);
+void            kinithart(void);
+void            kdup(void *);
+int             krefs(void *);
+int             kzero_fill(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            logdump(void);
+
+// mmap.c
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+void            mmapclear(struct proc*);
+int             mmapshare(struct proc*);
+int             mmapfork(struct proc*, struct proc*, int);
+uint64          mmaplow(struct proc*);
+int             mmappagein(pagetable_t, uint64, int, char**);
+uint64          mmapshm(struct shm*, uint64);
+int             shmdetach(uint64);
+
+// poll.c
+void            pollqueue(struct pollhead*, struct pollwait*);
+void            pollwake(struct pollhead*);
+int             poll(uint64, int, int);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipewrite(struct pipe*, int, uint64, int, int);
+int             pipepoll(struct pipe*, int, struct pollwait*);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
+void            kloginit(void);
+void            klogkick(void);
+
+// prof.c
+void            profinit(void);
+void            profsample(uint64, int);
+int             profctl(int);
+int             profread(uint64, int);
 
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+struct proc*    findproc(int);
+int             otherthreads(struct proc*);
+int             getprocinfo(uint64, int);
+int             setnice(int, int);
+int             setquantum(int, int);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int, int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
+struct kthread* mythread(void);
+int             killed(void);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+void            thread_exit(int);
+int             killothers(void);
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kproc(void (*)(void), char*);
 int             wait(uint64);
 void            wakeup(void*);
+int             sched_tick(void);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            tlbstale(struct proc*);
+uint64          proc_satp(struct proc*);
 uint            sigprocmask(uint);
 int             sigaction(int, const struct sigaction*, struct sigaction*);
-void            sigret(void);
+uint64          sigret(void);
 int             is_pending_and_not_masked(int);
 void            signalhandler(void);
 void            kernelsignalhandler(int);
@@ -118,16 +201,40 @@ void            copy_tf(struct trapframe*, struct trapframe*);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, uint64);
+uint64          shmattach(int);
+struct shm*     shmref(int);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+char*           shmpage(struct shm*, uint64);
+
+// sysfile.c
+int             fileopen(char*, int);
+int             fdclose(int);
+void            argfdput(void);
+
+// slab.c
+void            slabinit(struct slabcache*, char*, uint);
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             holdingany(void);
 void            initlock(struct spinlock*, char*);
+void            initticketlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             lockstatcopy(uint64, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquiresleep_shared(struct sleeplock*);
+void            downgradesleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -148,18 +255,37 @@ int             argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+int             getstats(int, uint64, int);
+
+// timer.c
+void            timer_add(struct timer*, uint);
+void            timer_del(struct timer*);
+void            timer_tick(void);
+void            timer_idle(void);
 
 // trap.c
 extern uint     ticks;
+extern uint64   tickstime;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
 
+// uring.c
+uint64          uring_setup(void);
+void            uring_free(struct proc*);
+int             uring_enter(int);
+
+// vdso.c
+void            vdsoinit(void);
+uint64          vdsopage(void);
+void            vdsotick(uint, uint64);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+void            uartwrite(char*, int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -167,29 +293,39 @@ int             uartgetc(void);
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+int             kvmmapstack(uint64, uint64);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, int);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, uint64, int);
+void            uvmprefault(pagetable_t, uint64, uint64, int);
+pte_t*          walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+extern int      noasid;
 
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
+void            plicroute(int);
 int             plic_claim(void);
 void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_start(struct buf **, int, int, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_rwv(struct buf **, int, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
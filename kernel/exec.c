@@ -3,12 +3,13 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
-
 int
 exec(char *path, char **argv)
 {
@@ -16,10 +17,13 @@ exec(char *path, char **argv)
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct vseg segs[NSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+  struct kthread *t = mythread();
 
   begin_op();
 
@@ -27,7 +31,7 @@ exec(char *path, char **argv)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,7 +42,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Note where the program goes; its pages are read
+  // from the file when the program first touches them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,17 +53,24 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < sz)
       goto bad;
-    sz = sz1;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg == NSEG)
       goto bad;
+    segs[nseg].va = ph.vaddr;
+    segs[nseg].end = ph.vaddr + ph.memsz;
+    segs[nseg].fileend = ph.vaddr + ph.filesz;
+    segs[nseg].off = ph.off;
+    segs[nseg].text = (ph.flags & ELF_PROG_FLAG_WRITE) == 0;
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep the reference to the file, for execpagein().
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   p = myproc();
@@ -100,7 +112,7 @@ exec(char *path, char **argv)
   // arguments to user main(argc, argv)
   // argc is returned via the system call return
   // value, which goes in a0.
-  p->trapframe->a1 = sp;
+  t->trapframe->a1 = sp;
 
   // Save program name for debugging.
   for(last=s=path; *s; s++)
@@ -108,13 +120,30 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
+  // The new image starts with just this thread.
+  if(killothers() < 0)
+    goto bad;
+
   // Commit to the user image.
+  mmapclear(p);
+  uring_free(p);
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
+  tlbstale(p);
   p->sz = sz;
-  p->trapframe->epc = elf.entry;  // initial program counter = main
-  p->trapframe->sp = sp; // initial stack pointer
+  p->exe = exe;
+  memmove(p->segs, segs, sizeof(segs));
+  p->nseg = nseg;
+  t->trapframe->epc = elf.entry;  // initial program counter = main
+  t->trapframe->sp = sp; // initial stack pointer
+  t->trapframe->tp = t->tid; // user code's thread id; see user/printf.c
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   //return all custom signals handlers to default - 2.1.2
   acquire(&p->lock);
@@ -136,33 +165,71 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Called by uvmfault() for a page at va that isn't mapped
+// yet. If the page belongs to a segment of the current
+// process's executable, set *page to a page holding it and
+// return the PTE permissions to map it with. Whole pages of
+// read-only text come from the page cache, shared with
+// every process running the same file, and are mapped
+// copy-on-write; other pages are read into a private page.
+// Returns 0 if the page isn't backed by the file, or -1 if
+// memory ran out, the read failed, or the read would have
+// had to sleep while the caller holds a spinlock
+// (uvmprefault() avoids that).
+int
+execpagein(pagetable_t pagetable, uint64 va, char **page)
 {
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  struct proc *p = myproc();
+  struct inode *ip;
+  struct vseg *s;
+  uint64 n;
+  uint off;
+  int share;
+  char *mem;
+
+  if(p == 0 || p->pagetable != pagetable || (ip = p->exe) == 0)
+    return 0;
+  for(s = p->segs; s < &p->segs[p->nseg]; s++){
+    if(va >= s->va && va < s->end)
+      break;
+  }
+  if(s == &p->segs[p->nseg] || va >= s->fileend)
+    return 0;
+
+  off = s->off + (va - s->va);
+  n = s->fileend - va;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  share = s->text && n == PGSIZE;
+  if(share && (mem = pagecache_lookup(ip->dev, ip->inum, off)) != 0){
+    *page = mem;
+    return PTE_R|PTE_X|PTE_U|PTE_COW;
+  }
+
+  if(holdingany())
+    return -1;
+
+  if((mem = (n == PGSIZE ? kalloc() : kalloc_zeroed())) == 0)
+    return -1;
+  ilockshared(ip);
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    iunlock(ip);
+    kfree(mem);
+    return -1;
+  }
+  if(share){
+    pagecache_enter(ip->dev, ip->inum, off, mem);
+    ip->pcached = 1;
   }
-  
-  return 0;
+  iunlock(ip);
+  *page = mem;
+  return share ? PTE_R|PTE_X|PTE_U|PTE_COW : PTE_W|PTE_X|PTE_R|PTE_U;
 }
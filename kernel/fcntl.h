@@ -3,3 +3,21 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_NONBLOCK 0x800  // pipe and console reads, and pipe writes, don't sleep
+
+// fcntl() commands
+#define F_GETFL   3   // return the O_NONBLOCK flag
+#define F_SETFL   4   // set it from arg
+
+// read() and write() on an O_NONBLOCK file return -EAGAIN
+// instead of sleeping; -1 is still any other error.
+#define EAGAIN    11
+
+// mmap() protections and flags
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define PROT_EXEC     0x4
+#define MAP_SHARED    0x01  // stores go back to the file, and to forked children
+#define MAP_PRIVATE   0x02  // stores stay in this process
+#define MAP_ANONYMOUS 0x20  // zero-filled memory, not a file
+#define MAP_FAILED    ((void*)-1)
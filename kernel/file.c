@@ -12,17 +12,25 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
+#include "uio.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;  // protects each file's ref
+  int nfile;             // allocated, up to NFILE; atomic
 } ftable;
 
+static struct slabcache filecache;
+
 void
 fileinit(void)
 {
+  if(NOFILE > PGSIZE / sizeof(struct file*) || NOFILE % 64 || NOFILE < NOFILE0)
+    panic("fileinit");
   initlock(&ftable.lock, "ftable");
+  slabinit(&filecache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -31,16 +39,17 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(__sync_fetch_and_add(&ftable.nfile, 1) >= NFILE){
+    __sync_fetch_and_sub(&ftable.nfile, 1);
+    return 0;
   }
-  release(&ftable.lock);
-  return 0;
+  if((f = slaballoc(&filecache)) == 0){
+    __sync_fetch_and_sub(&ftable.nfile, 1);
+    return 0;
+  }
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,6 +81,8 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  slabfree(&filecache, f);
+  __sync_fetch_and_sub(&ftable.nfile, 1);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -91,7 +102,7 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
     iunlock(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
@@ -101,82 +112,405 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// Read from file f into the cnt buffers of iov, which are
+// at user addresses. Reads at *off if off isn't 0 (only
+// for inodes), and otherwise at and advancing f->off.
+// Stops at the first short read, as read() would.
 int
-fileread(struct file *f, uint64 addr, int n)
+filereadv(struct file *f, struct iovec *iov, int cnt, uint *off)
 {
-  int r = 0;
+  int i, r, tot = 0;
+  uint o;
 
-  if(f->readable == 0)
+  if(f->readable == 0 || (off && f->type != FD_INODE))
     return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
-      return -1;
-    r = devsw[f->major].read(1, addr, n);
-  } else if(f->type == FD_INODE){
+  // pipes and devices copy with a spinlock held, and
+  // files with the inode locked, so fault in any part of
+  // the buffer that would come from an executable now.
+  for(i = 0; i < cnt; i++)
+    uvmprefault(myproc()->pagetable, (uint64)iov[i].base, iov[i].len, 1);
+
+  if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    o = off ? *off : f->off;
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, 1, (uint64)iov[i].base, o, iov[i].len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      o += r;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    if(off)
+      *off = o;
+    else
+      f->off = o;
     iunlock(f->ip);
-  } else {
-    panic("fileread");
+    return tot;
   }
 
-  return r;
+  for(i = 0; i < cnt; i++){
+    if(f->type == FD_PIPE){
+      r = piperead(f->pipe, (uint64)iov[i].base, iov[i].len, f->nonblock);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+        return -1;
+      r = devsw[f->major].read(1, (uint64)iov[i].base, iov[i].len, f->nonblock);
+    } else {
+      panic("fileread");
+    }
+    if(r < 0){
+      if(tot == 0)
+        tot = r;
+      break;
+    }
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  return tot;
 }
 
-// Write to file f.
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
 
-  if(f->writable == 0)
+  if(n < 0)
     return -1;
+  iov.base = (void*)addr;
+  iov.len = n;
+  return filereadv(f, &iov, 1, 0);
+}
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
-      return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
+// Write the cnt buffers of iov to inode ip at *o, in as
+// few log transactions as will hold them. Advances *o, and
+// f->off too if f isn't 0. Returns bytes written, or -1
+// if not all of them could be.
+static int
+iwritev(struct inode *ip, int user_src, struct iovec *iov, int cnt, uint *o,
+        struct file *f)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i = 0, done = 0, room, m, r, tot = 0, err = 0;
+
+  while(i < cnt && !err){
+    begin_op();
+    ilock(ip);
+    if(f)
+      *o = f->off;
+    // as many buffers, or parts of them, as fit.
+    for(room = max; i < cnt && room > 0; ){
+      m = iov[i].len - done;
+      if(m > room)
+        m = room;
+      if((r = writei(ip, user_src, (uint64)iov[i].base + done, *o, m)) > 0){
+        *o += r;
+        tot += r;
+        room -= r;
+        done += r;
+      }
+      if(r < 0 || r != m){
         // error from writei
+        err = 1;
         break;
       }
-      i += r;
+      if(done == iov[i].len){
+        i++;
+        done = 0;
+      }
+    }
+    if(f)
+      f->off = *o;
+    iunlock(ip);
+    end_op();
+  }
+  return err ? -1 : tot;
+}
+
+// Write the cnt buffers of iov to file f, which is
+// writable. They are at user addresses if user_src is set,
+// else kernel addresses. Writes at *off if off isn't 0
+// (only for inodes), and otherwise at and advancing f->off.
+static int
+fwritev(struct file *f, int user_src, struct iovec *iov, int cnt, uint *off)
+{
+  int i, r, tot = 0;
+  uint o;
+
+  if(off && f->type != FD_INODE)
+    return -1;
+  if(f->type == FD_INODE){
+    if(off)
+      return iwritev(f->ip, user_src, iov, cnt, off, 0);
+    return iwritev(f->ip, user_src, iov, cnt, &o, f);
+  }
+
+  for(i = 0; i < cnt; i++){
+    if(f->type == FD_PIPE){
+      r = pipewrite(f->pipe, user_src, (uint64)iov[i].base, iov[i].len, f->nonblock);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+        return -1;
+      r = devsw[f->major].write(user_src, (uint64)iov[i].base, iov[i].len);
+    } else {
+      panic("filewrite");
+    }
+    if(r < 0){
+      if(tot == 0)
+        tot = r;
+      break;
+    }
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  return tot;
+}
+
+// Write to file f from the cnt buffers of iov, which are
+// at user addresses, at *off or f->off as for filereadv().
+int
+filewritev(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+  int i;
+
+  if(f->writable == 0)
+    return -1;
+
+  // as in filereadv().
+  for(i = 0; i < cnt; i++)
+    uvmprefault(myproc()->pagetable, (uint64)iov[i].base, iov[i].len, 0);
+
+  return fwritev(f, 1, iov, cnt, off);
+}
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  if(n < 0)
+    return -1;
+  iov.base = (void*)addr;
+  iov.len = n;
+  return filewritev(f, &iov, 1, 0);
+}
+
+// Copy up to n bytes of file in, from offset *off, to out,
+// without a trip through user space: each page is read
+// from the buffer cache into a kernel page, then written
+// to out's inode, pipe or device. in must be an inode.
+// Advances *off. Returns the number of bytes copied, 0 at
+// the end of in, or -1 (or -EAGAIN) if nothing could be.
+int
+filesend(struct file *out, struct file *in, uint *off, int n)
+{
+  char *buf;
+  int m, r, w, tot;
+  struct iovec iov;
+
+  if(in->readable == 0 || in->type != FD_INODE || out->writable == 0 || n < 0)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  tot = 0;
+  while(tot < n){
+    m = n - tot < PGSIZE ? n - tot : PGSIZE;
+    ilockshared(in->ip);
+    r = readi(in->ip, 0, (uint64)buf, *off, m);
+    iunlock(in->ip);
+    if(r <= 0){
+      if(r < 0 && tot == 0)
+        tot = -1;
+      break;
+    }
+    iov.base = buf;
+    iov.len = r;
+    if((w = fwritev(out, 0, &iov, 1, 0)) < 0){
+      if(tot == 0)
+        tot = w;
+      break;
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+    *off += w;
+    tot += w;
+    if(w < r)
+      break;
+  }
+  kfree(buf);
+  return tot;
+}
+
+// For poll(): what f can do without blocking, as POLL bits.
+// If w isn't 0, also queue it on the object behind f, if
+// that can change.
+int
+filepoll(struct file *f, struct pollwait *w)
+{
+  int m;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->readable, w);
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV && devsw[f->major].poll)
+    m = devsw[f->major].poll(w);
+  else
+    m = POLLIN | POLLOUT;
+  if(!f->readable)
+    m &= ~POLLIN;
+  if(!f->writable)
+    m &= ~POLLOUT;
+  return m;
+}
+
+// A process's descriptors start in p->ofile0. The first
+// fd past NOFILE0 moves them to a page of NOFILE, which is
+// kept until exit. p->fdbits marks the fds in use, so
+// fdalloc() finds the lowest free one a word at a time.
+// Changes are made with p->lock held; fdfile() looks without
+// it, and ofile0 stays valid, so a thread that read the old
+// table pointer still sees a table.
+
+// The file open on fd in p, or 0.
+struct file*
+fdfile(struct proc *p, int fd)
+{
+  struct file **ofile = __atomic_load_n(&p->ofile, __ATOMIC_ACQUIRE);
+
+  if(fd < 0 || fd >= (ofile == p->ofile0 ? NOFILE0 : NOFILE))
+    return 0;
+  return ofile[fd];
+}
+
+// Like fdfile(), for a file the caller will use for a
+// while. If another thread of p could close fd meanwhile,
+// the file comes with a new reference and *held is set;
+// drop it with fileclose(). None can start while the
+// caller is p's only thread.
+struct file*
+fdget(struct proc *p, int fd, int *held)
+{
+  struct file *f;
+
+  *held = 0;
+  if(!otherthreads(p))
+    return fdfile(p, fd);
+  acquire(&p->lock);
+  if((f = fdfile(p, fd)) != 0){
+    filedup(f);
+    *held = 1;
   }
+  release(&p->lock);
+  return f;
+}
+
+// Move p's descriptors to a page. Caller holds p->lock.
+static int
+fdgrow(struct proc *p)
+{
+  struct file **ofile;
 
-  return ret;
+  if((ofile = kalloc_zeroed()) == 0)
+    return -1;
+  memmove(ofile, p->ofile0, sizeof(p->ofile0));
+  __atomic_store_n(&p->ofile, ofile, __ATOMIC_RELEASE);
+  return 0;
 }
 
+// Allocate the lowest free file descriptor for f in the
+// current process. Takes over the caller's reference to f
+// on success. Returns the fd, or -1.
+int
+fdalloc(struct file *f)
+{
+  struct proc *p = myproc();
+  int i, fd;
+
+  acquire(&p->lock);
+  for(i = 0; i < NOFILE/64; i++){
+    if(~p->fdbits[i])
+      break;
+  }
+  if(i == NOFILE/64){
+    release(&p->lock);
+    return -1;
+  }
+  fd = i*64 + __builtin_ctzl(~p->fdbits[i]);
+  if(fd >= NOFILE0 && p->ofile == p->ofile0 && fdgrow(p) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  p->fdbits[i] |= 1L << (fd % 64);
+  p->ofile[fd] = f;
+  release(&p->lock);
+  return fd;
+}
+
+// Free fd in p, and return the file that was open on it,
+// with its reference, or 0.
+struct file*
+fdtake(struct proc *p, int fd)
+{
+  struct file *f;
+
+  acquire(&p->lock);
+  if((f = fdfile(p, fd)) != 0){
+    p->ofile[fd] = 0;
+    p->fdbits[fd / 64] &= ~(1L << (fd % 64));
+  }
+  release(&p->lock);
+  return f;
+}
+
+// Give np, which fork() has just made, p's descriptors.
+// Returns 0, or -1 with nothing copied. np->lock is held.
+int
+fdcopy(struct proc *np, struct proc *p)
+{
+  int fd;
+
+  acquire(&p->lock);
+  if(p->ofile != p->ofile0 && fdgrow(np) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  for(fd = 0; fd < (p->ofile == p->ofile0 ? NOFILE0 : NOFILE); fd++){
+    if(p->ofile[fd])
+      np->ofile[fd] = filedup(p->ofile[fd]);
+  }
+  memmove(np->fdbits, p->fdbits, sizeof(p->fdbits));
+  release(&p->lock);
+  return 0;
+}
+
+// Close all of p's descriptors, for exit(), and go back
+// to ofile0. No other thread of p may be running.
+void
+fdcloseall(struct proc *p)
+{
+  struct file *f;
+  int fd;
+
+  for(fd = 0; fd < NOFILE; fd++){
+    if((p->fdbits[fd / 64] & (1L << (fd % 64))) && (f = fdtake(p, fd)) != 0)
+      fileclose(f);
+  }
+  if(p->ofile != p->ofile0){
+    kfree(p->ofile);
+    p->ofile = p->ofile0;
+  }
+}
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
@@ -18,6 +19,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // itable hash chain
+  struct inode *prev; // LRU list of free entries
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,13 +30,22 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  // hints only; readers holding the lock shared race on these.
+  uint nextbn;        // block a sequential readi() would read next
+  uint raend;         // read-ahead has been started up to here
+  uint goal;          // where to put the next block allocated
+  int pcached;        // pages of it may be in the page cache
 };
 
+struct pollwait;
+
 // map major device number to device functions.
 struct devsw {
-  int (*read)(int, uint64, int);
+  int (*read)(int, uint64, int, int);  // last: nonblocking
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollwait*);  // 0 if never blocks; see poll.c
 };
 
 extern struct devsw devsw[];
@@ -26,6 +26,18 @@
 // only one device
 struct superblock sb; 
 
+// Allocation hints, kept in memory only. nfree[i] counts
+// the free bits in bitmap block i, or is -1 until that block
+// has been read; it is only changed with the bitmap block
+// locked, and lets balloc() pass over full blocks without
+// reading them. next is where the last allocation ended.
+#define NBMAP (FSSIZE/BPB + 1)
+
+static struct {
+  uint next;
+  int nfree[NBMAP];
+} bhint;
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +56,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  memset(bhint.nfree, -1, sizeof(bhint.nfree));
 }
 
 // Zero a block.
@@ -60,22 +73,67 @@ bzero(int dev, int bno)
 
 // Blocks.
 
+// Free count of the bitmap block that holds bit b, or -1.
+static int
+bhintget(uint b)
+{
+  if(b / BPB >= NBMAP)
+    return -1;
+  return bhint.nfree[b / BPB];
+}
+
+// Add n to the free count held for the bitmap block bp,
+// which holds bit b, counting its free bits if need be.
+static void
+bhintadd(uint b, struct buf *bp, int n)
+{
+  int bi, i, nfree;
+
+  if((i = b / BPB) >= NBMAP)
+    return;
+  b = i * BPB;
+  if(bhint.nfree[i] < 0){
+    nfree = 0;
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        nfree++;
+    bhint.nfree[i] = nfree;
+  }
+  bhint.nfree[i] += n;
+}
+
 // Allocate a zeroed disk block.
+// Takes the first free block at or after goal, so that a
+// file's blocks can be contiguous; goal 0 means carry on
+// from the last allocation.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int b, bi, m, i, n;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(goal == 0 || goal >= sb.size)
+    goal = bhint.next;
+  if(goal >= sb.size)
+    goal = 0;
+
+  // visit each bitmap block starting at goal's, and goal's
+  // again last for the bits before goal.
+  n = (sb.size + BPB - 1) / BPB;
+  for(i = 0; i <= n; i++){
+    b = ((goal / BPB + i) % n) * BPB;
+    if(bhintget(b) == 0)
+      continue;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    bhintadd(b, bp, 0);
+    for(bi = i == 0 ? goal % BPB : 0; bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
+        bhintadd(b, bp, -1);
         brelse(bp);
+        bhint.next = b + bi + 1;
         bzero(dev, b + bi);
         return b + bi;
       }
@@ -85,21 +143,50 @@ balloc(uint dev)
   panic("balloc: out of blocks");
 }
 
+// Free the disk blocks in bs[0..n-1], skipping zeros, one
+// bitmap block at a time in bitmap block order, so each
+// bitmap block is read and logged once. Returns how many
+// bitmap blocks it changed.
+static int
+bfreev(int dev, uint *bs, int n)
+{
+  struct buf *bp;
+  uint bb, last, next;
+  int i, bi, m, nb;
+
+  nb = 0;
+  for(last = 0; ; last = next){
+    next = 0;
+    for(i = 0; i < n; i++){
+      bb = BBLOCK(bs[i], sb);
+      if(bs[i] && bb > last && (next == 0 || bb < next))
+        next = bb;
+    }
+    if(next == 0)
+      return nb;
+
+    bp = bread(dev, next);
+    for(i = 0; i < n; i++){
+      if(bs[i] == 0 || BBLOCK(bs[i], sb) != next)
+        continue;
+      bi = bs[i] % BPB;
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bhintadd(bs[i], bp, 1);
+      bp->data[bi/8] &= ~m;
+    }
+    log_write(bp);
+    brelse(bp);
+    nb++;
+  }
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
-  struct buf *bp;
-  int bi, m;
-
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  bfreev(dev, &b, 1);
 }
 
 // Inodes.
@@ -132,7 +219,9 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. A free entry keeps its inode, and
+//   stays valid, until iget() recycles it for another;
+//   iget() recycles the least recently used free entry.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -165,29 +254,82 @@ bfree(int dev, uint b)
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those fields,
+// or the hash chains and LRU list.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 67
+
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];  // chains through hnext, by (dev, inum)
+  struct inode lru;  // free entries, least recently used at lru.prev
 } itable;
 
+static int
+ihash(uint dev, uint inum)
+{
+  return (dev * 131 + inum) % NIHASH;
+}
+
+// Take ip off the LRU list.
+static void
+lruremove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Put ip on the LRU list, as the most recently used
+// entry, or as the least if it no longer holds an inode.
+static void
+lruinsert(struct inode *ip, int old)
+{
+  struct inode *at = old ? itable.lru.prev : &itable.lru;
+
+  ip->next = at->next;
+  ip->prev = at;
+  at->next->prev = ip;
+  at->next = ip;
+}
+
+// Take ip off its hash chain, if it is on one.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  if(ip->inum == 0)
+    return;
+  for(pp = &itable.hash[ihash(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
+  ip->inum = 0;
+}
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  itable.lru.prev = &itable.lru;
+  itable.lru.next = &itable.lru;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    lruinsert(&itable.inode[i], 1);
   }
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void truncate(struct inode *ip, int split);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -242,31 +384,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  int h;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  h = ihash(dev, inum);
+  for(ip = itable.hash[h]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used free entry.
+  ip = itable.lru.prev;
+  if(ip == &itable.lru)
     panic("iget: no inodes");
+  lruremove(ip);
+  iunhash(ip);
+  if(ip->pcached){
+    pagecache_purge(ip->dev, ip->inum);
+    ip->pcached = 0;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = itable.hash[h];
+  itable.hash[h] = ip;
   release(&itable.lock);
 
   return ip;
@@ -306,13 +456,35 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->nextbn = 0;
+    ip->raend = 0;
+    ip->goal = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode shared, for reading only: any number
+// of processes can readi() it at once. Only an exclusive
+// holder may change the inode or its contents.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleep_shared(&ip->lock);
+  if(ip->valid)
+    return;
+
+  // reading it in from disk needs the lock exclusively.
+  releasesleep(&ip->lock);
+  ilock(ip);
+  downgradesleep(&ip->lock);
+}
+
+// Unlock the given inode, whichever way it is locked.
 void
 iunlock(struct inode *ip)
 {
@@ -343,7 +515,9 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
-    itrunc(ip);
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
+    truncate(ip, 1);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
@@ -353,7 +527,10 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  // a free entry stays cached; one whose inode was just
+  // freed is the first to be recycled.
+  if(--ip->ref == 0)
+    lruinsert(ip, ip->valid == 0);
   release(&itable.lock);
 }
 
@@ -370,72 +547,165 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT after
+// those are listed in the NINDIRECT blocks that block
+// ip->addrs[NDIRECT+1] lists.
+//
+// New blocks are put just after the file's previous block
+// when that is free, so that files tend to be contiguous.
+
+// Where to put a block that follows block prev.
+#define GOAL(prev) ((prev) ? (prev) + 1 : 0)
+
+// Allocate a block for ip at goal or, without a goal,
+// just after the block ip was last given.
+static uint
+bnew(struct inode *ip, uint goal)
+{
+  uint b;
+
+  b = balloc(ip->dev, goal ? goal : ip->goal);
+  ip->goal = b + 1;
+  return b;
+}
+
+// Return entry n of indirect block blk. If there is no
+// such block, allocate one, near goal unless entry n-1
+// gives a better place.
+static uint
+ientry(struct inode *ip, uint blk, uint n, uint goal)
+{
+  uint addr, *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, blk);
+  a = (uint*)bp->data;
+  if((addr = a[n]) == 0){
+    if(n > 0 && a[n-1])
+      goal = a[n-1] + 1;
+    a[n] = addr = bnew(ip, goal);
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, goal;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = bnew(ip, bn > 0 ? GOAL(ip->addrs[bn-1]) : 0);
     return addr;
   }
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
+    goal = GOAL(ip->addrs[NDIRECT-1]);
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+      ip->addrs[NDIRECT] = addr = bnew(ip, goal);
+    return ientry(ip, addr, bn, GOAL(addr));
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load the double-indirect block, then the indirect
+    // block it lists, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = bnew(ip, 0);
+    addr = ientry(ip, addr, bn / NINDIRECT, GOAL(addr));
+    return ientry(ip, addr, bn % NINDIRECT, GOAL(addr));
   }
 
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Free indirect block blk and the blocks it lists.
+// Returns how many bitmap blocks that changed.
+static int
+ifree(struct inode *ip, uint blk)
+{
+  struct buf *bp;
+  int n;
+
+  bp = bread(ip->dev, blk);
+  n = bfreev(ip->dev, (uint*)bp->data, NINDIRECT);
+  brelse(bp);
+  bfree(ip->dev, blk);
+  return n + 1;
+}
+
+// Truncate inode (discard contents), in pieces of one
+// indirect block. If split is set, commit the truncation so
+// far whenever it has changed about half a transaction's
+// worth of bitmap blocks, so that freeing a big file needs
+// any number of transactions. Each commit leaves the inode
+// pointing only at blocks that are still allocated.
+// Only iput() splits: there ip->ref is 1, so no operation
+// that holds the log open can be waiting for ip->lock.
+static void
+truncate(struct inode *ip, int split)
 {
-  int i, j;
   struct buf *bp;
   uint *a;
+  int j, n;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  if(ip->pcached){
+    pagecache_purge(ip->dev, ip->inum);
+    ip->pcached = 0;
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  n = 0;
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    for(j = NINDIRECT-1; j >= 0; j--){
+      if(a[j] == 0)
+        continue;
+      n += ifree(ip, a[j]);
+      a[j] = 0;
+      log_write(bp);
+      if(split && n >= MAXOPBLOCKS/2){
+        brelse(bp);
+        end_op();
+        begin_op();
+        n = 0;
+        bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+        a = (uint*)bp->data;
+      }
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  if(ip->addrs[NDIRECT]){
+    ifree(ip, ip->addrs[NDIRECT]);
     ip->addrs[NDIRECT] = 0;
   }
 
+  bfreev(ip->dev, ip->addrs, NDIRECT);
+  for(j = 0; j < NDIRECT; j++)
+    ip->addrs[j] = 0;
+
   ip->size = 0;
+  ip->raend = 0;
   iupdate(ip);
 }
 
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void
+itrunc(struct inode *ip)
+{
+  truncate(ip, 0);
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -448,6 +718,32 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Blocks that a sequential reader gets ahead of time.
+#define NREADAHEAD 4
+
+// Start reading the file's blocks from bn up to NREADAHEAD
+// blocks on into the buffer cache, unless already started,
+// so that sequential readi()s find them there.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint end, blocks[NREADAHEAD];
+  int n;
+
+  end = min(bn + NREADAHEAD, (ip->size + BSIZE - 1) / BSIZE);
+  if(ip->raend > bn && ip->raend <= end)
+    bn = ip->raend;
+  // blocks below ip->size are all allocated, so bmap()
+  // only looks up.
+  for(n = 0; bn < end; bn++)
+    blocks[n++] = bmap(ip, bn);
+  if(n > 0)
+    breadahead(ip->dev, blocks, n);
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -455,7 +751,7 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, seq;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -463,8 +759,13 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  // carrying on from where the last read stopped?
+  seq = off/BSIZE == ip->nextbn;
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if(seq)
+      readahead(ip, off/BSIZE + 1);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
@@ -473,6 +774,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     }
     brelse(bp);
   }
+  ip->nextbn = off/BSIZE;
   return tot;
 }
 
@@ -493,6 +795,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->pcached){
+    pagecache_purge(ip->dev, ip->inum);
+    ip->pcached = 0;
+  }
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -524,31 +830,235 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hash of a directory entry name, for indexed directories.
+// mkfs has a copy.
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+#define DIRINDEXED(dp) ((dp)->size > BSIZE)
+
+// Which record of index block bp covers hash h.
+static int
+dirleaf(struct buf *bp, uint h)
+{
+  struct dirindex *x;
+  int i;
+
+  x = (struct dirindex*)bp->data;
+  if(x[0].magic != DIRMAGIC)
+    panic("dirleaf");
+  for(i = 1; i < NDIRINDEX && x[i].magic == DIRMAGIC && x[i].hash <= h; i++)
+    ;
+  return i - 1;
+}
+
+// Read through dp for name; return its inum, and its offset
+// in *poff, or 0 if it is not there. An indexed directory
+// only needs its index block and one leaf.
+static uint
+dirscan(struct inode *dp, char *name, uint *poff)
+{
+  uint off, bn, inum;
+  struct dirent de, *d;
+  struct buf *bp;
+  int i;
+
+  if(!DIRINDEXED(dp)){
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlookup read");
+      if(de.inum == 0)
+        continue;
+      if(namecmp(name, de.name) == 0){
+        // entry matches path element
+        *poff = off;
+        return de.inum;
+      }
+    }
+    return 0;
+  }
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  bn = ((struct dirindex*)bp->data)[dirleaf(bp, dirhash(name))].bn;
+  brelse(bp);
+  bp = bread(dp->dev, bmap(dp, bn));
+  d = (struct dirent*)bp->data;
+  inum = 0;
+  for(i = 0; i < DPB; i++){
+    if(d[i].inum != 0 && namecmp(name, d[i].name) == 0){
+      *poff = bn*BSIZE + i*sizeof(de);
+      inum = d[i].inum;
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// The answer, found or not, goes in the name cache.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dcache_lookup(dp->dev, dp->inum, name, &inum, &off) == 0){
+    inum = dirscan(dp, name, &off);
+    dcache_enter(dp->dev, dp->inum, name, inum, inum ? off : 0);
+  }
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
+}
+
+// Turn dp, a linear directory with one full block, into an
+// indexed one: its dirents move to block 1, the only leaf,
+// and block 0 becomes the index.
+static void
+dirindex(struct inode *dp)
+{
+  struct buf *bp, *lp;
+  struct dirindex *x;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  lp = bread(dp->dev, bmap(dp, 1));
+  memmove(lp->data, bp->data, BSIZE);
+  log_write(lp);
+  brelse(lp);
+
+  memset(bp->data, 0, BSIZE);
+  x = (struct dirindex*)bp->data;
+  x[0].magic = DIRMAGIC;
+  x[0].hash = 0;
+  x[0].bn = 1;
+  log_write(bp);
+  brelse(bp);
+
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+  dcache_purge(dp->dev, dp->inum);   // the offsets changed
+}
+
+// Split full leaf lp, which index record i of bp names, moving
+// the dirents that hash at or above a middle value to a new
+// leaf. h, the hash of the name about to be added, counts
+// toward the middle. Returns the new leaf, or 0 if the index
+// is full or every name has the same hash.
+static struct buf*
+dirsplit(struct inode *dp, struct buf *bp, int i, struct buf *lp, uint h)
+{
+  struct dirindex *x;
+  struct dirent *d, *nd;
+  struct buf *np;
+  uint hs[DPB+1], mid, t, nbn;
+  int j, k, n;
+
+  x = (struct dirindex*)bp->data;
+  if(x[NDIRINDEX-1].magic == DIRMAGIC)
+    return 0;
+
+  // sort the hashes and take the middle one, or failing that
+  // the first above the lowest, so both halves are non-empty.
+  d = (struct dirent*)lp->data;
+  for(j = 0; j < DPB; j++)
+    hs[j] = dirhash(d[j].name);
+  hs[DPB] = h;
+  for(j = 1; j <= DPB; j++){
+    t = hs[j];
+    for(k = j; k > 0 && hs[k-1] > t; k--)
+      hs[k] = hs[k-1];
+    hs[k] = t;
+  }
+  mid = hs[DPB/2];
+  for(j = DPB/2; mid == hs[0] && j <= DPB; j++)
+    mid = hs[j];
+  if(mid == hs[0])
+    return 0;
+
+  nbn = dp->size / BSIZE;
+  np = bread(dp->dev, bmap(dp, nbn));
+  nd = (struct dirent*)np->data;
+  for(j = 0, n = 0; j < DPB; j++){
+    if(dirhash(d[j].name) >= mid){
+      nd[n++] = d[j];
+      memset(&d[j], 0, sizeof(d[j]));
     }
   }
+  log_write(lp);
+  log_write(np);
+
+  for(j = NDIRINDEX-1; j > i+1; j--)
+    x[j] = x[j-1];
+  x[i+1].inum = 0;
+  x[i+1].magic = DIRMAGIC;
+  x[i+1].hash = mid;
+  x[i+1].bn = nbn;
+  log_write(bp);
 
+  dp->size += BSIZE;
+  iupdate(dp);
+  dcache_purge(dp->dev, dp->inum);   // the offsets changed
+  return np;
+}
+
+// Add (name, inum) to indexed directory dp.
+static int
+dirinsert(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bp, *lp, *np;
+  struct dirent *d;
+  uint h, bn;
+  int i, j;
+
+  h = dirhash(name);
+  bp = bread(dp->dev, bmap(dp, 0));
+  i = dirleaf(bp, h);
+  bn = ((struct dirindex*)bp->data)[i].bn;
+  lp = bread(dp->dev, bmap(dp, bn));
+  d = (struct dirent*)lp->data;
+  for(j = 0; j < DPB && d[j].inum != 0; j++)
+    ;
+  if(j == DPB){
+    if((np = dirsplit(dp, bp, i, lp, h)) == 0){
+      brelse(lp);
+      brelse(bp);
+      return -1;
+    }
+    if(h >= ((struct dirindex*)bp->data)[i+1].hash){
+      brelse(lp);
+      lp = np;
+      bn = dp->size/BSIZE - 1;
+    } else {
+      brelse(np);
+    }
+    d = (struct dirent*)lp->data;
+    for(j = 0; d[j].inum != 0; j++)
+      ;
+  }
+  brelse(bp);
+
+  strncpy(d[j].name, name, DIRSIZ);
+  d[j].inum = inum;
+  log_write(lp);
+  brelse(lp);
+  dcache_enter(dp->dev, dp->inum, name, inum, bn*BSIZE + j*sizeof(*d));
   return 0;
 }
 
@@ -566,6 +1076,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(DIRINDEXED(dp))
+    return dirinsert(dp, name, inum);
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -574,10 +1087,17 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // a full block: index the directory rather than grow it.
+  if(off >= BSIZE){
+    dirindex(dp);
+    return dirinsert(dp, name, inum);
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcache_enter(dp->dev, dp->inum, name, inum, off);
 
   return 0;
 }
@@ -636,7 +1156,7 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
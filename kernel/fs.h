@@ -24,9 +24,14 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+// Most data blocks a log region can have: its header
+// block lists them.
+#define MAXLOG (BSIZE / sizeof(uint) - 3)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +40,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -58,3 +63,23 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Dirents per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory bigger than one block is indexed: block 0
+// holds dirindex records sorted by hash, and each names a
+// leaf block of dirents whose names hash from that record's
+// hash up to the next one's. A record starts with a zero
+// inum, so to readers the index block is all empty dirents.
+#define DIRMAGIC 0x6478
+
+struct dirindex {
+  ushort inum;  // always 0
+  ushort magic; // DIRMAGIC in a record in use
+  uint hash;    // lowest name hash in the leaf
+  uint bn;      // leaf's block number within the directory
+  uint pad;
+};
+
+#define NDIRINDEX     (BSIZE / sizeof(struct dirindex))
+
@@ -9,8 +9,6 @@
 #include "riscv.h"
 #include "defs.h"
 
-void freerange(void *pa_start, void *pa_end);
-
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
@@ -18,48 +16,295 @@ struct run {
   struct run *next;
 };
 
+static int kfreechunk(void);
+
+// pages can be shared copy-on-write after fork(), so each
+// page has a count of the page tables (or kernel users) that
+// refer to it; kfree() only frees a page when it drops to 0.
+// the counts are updated with atomic instructions.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+// free pages move between a cpu's cache and the
+// global pool KBATCH at a time.
+#define KBATCH 32
+
+// the global pool.
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int ref[PA2REF(PHYSTOP)];
 } kmem;
 
+// each cpu allocates from and frees to its own cache,
+// so that kalloc() and kfree() rarely touch kmem.lock.
+// the lock is only contended when another cpu steals.
+// lock order: a cache's lock, then kmem.lock.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} kcache[NCPU];
+
+// pages that have already been zeroed, by idle cpus, so
+// that kalloc_zeroed() need not clear a page itself.
+// the pages count as allocated (ref 1) while they wait.
+#define KZEROMAX 64
+
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} kzero;
+
+// at boot the pages from end to PHYSTOP are made free a
+// chunk at a time, by each hart as it starts, so that big
+// memories don't hold up booting on one hart. a free page's
+// count is already 0, and kalloc() fills it with junk anyway,
+// so each one only needs linking into a list.
+#define KCHUNK (1024*PGSIZE)
+
+int kchunks;  // chunks claimed so far; atomic
+
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  struct kcache *c;
+
+  initticketlock(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  for(c = kcache; c < &kcache[NCPU]; c++)
+    initlock(&c->lock, "kcache");
+  // enough for hart 0 to boot; see kinithart().
+  kfreechunk();
 }
 
+// Claim the next chunk of never-used memory and free its
+// pages: KBATCH of them to this cpu's cache, the rest to the
+// global pool, taking each lock once. Returns 0 when there
+// are no chunks left.
+static int
+kfreechunk(void)
+{
+  struct run *r, *head, *tail, *mine;
+  struct kcache *c;
+  char *p, *start, *stop;
+  int n;
+
+  start = (char*)PGROUNDUP((uint64)end) + (uint64)__sync_fetch_and_add(&kchunks, 1) * KCHUNK;
+  if(start >= (char*)PHYSTOP)
+    return 0;
+  stop = start + KCHUNK < (char*)PHYSTOP ? start + KCHUNK : (char*)PHYSTOP;
+
+  head = tail = mine = 0;
+  n = 0;
+  for(p = start; p + PGSIZE <= stop; p += PGSIZE){
+    r = (struct run*)p;
+    if(n < KBATCH){
+      r->next = mine;
+      mine = r;
+      n++;
+      continue;
+    }
+    r->next = head;
+    if(head == 0)
+      tail = r;
+    head = r;
+  }
+
+  push_off();
+  c = &kcache[cpuid()];
+  acquire(&c->lock);
+  for(; mine; mine = r){
+    r = mine->next;
+    mine->next = c->freelist;
+    c->freelist = mine;
+    c->n++;
+  }
+  if(head){
+    acquire(&kmem.lock);
+    tail->next = kmem.freelist;
+    kmem.freelist = head;
+    release(&kmem.lock);
+  }
+  release(&c->lock);
+  pop_off();
+  return 1;
+}
+
+// Help free the rest of memory, from each hart in main().
 void
-freerange(void *pa_start, void *pa_end)
+kinithart(void)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  while(kfreechunk())
+    ;
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Move up to KBATCH pages from the global pool to c.
+// Caller holds c->lock.
+static void
+krefill(struct kcache *c)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KBATCH && (r = kmem.freelist) != 0; i++){
+    kmem.freelist = r->next;
+    r->next = c->freelist;
+    c->freelist = r;
+    c->n++;
+  }
+  release(&kmem.lock);
+}
+
+// Move KBATCH pages from c back to the global pool.
+// Caller holds c->lock.
+static void
+kdrain(struct kcache *c)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KBATCH && (r = c->freelist) != 0; i++){
+    c->freelist = r->next;
+    c->n--;
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+  }
+  release(&kmem.lock);
+}
+
+// The global pool is empty too: take half of the
+// fullest other cpu's cache. Returns one page, and
+// keeps the rest in c. Caller holds no cache lock.
+static struct run*
+ksteal(struct kcache *c)
+{
+  struct kcache *v, *victim;
+  struct run *r, *rest, **pp;
+  int i, n;
+
+  // pick a victim without locks; recheck below.
+  victim = 0;
+  for(v = kcache; v < &kcache[NCPU]; v++){
+    if(v != c && v->n > 0 && (victim == 0 || v->n > victim->n))
+      victim = v;
+  }
+  if(victim == 0)
+    return 0;
+
+  acquire(&victim->lock);
+  if(victim->n == 0){
+    release(&victim->lock);
+    return 0;
+  }
+  n = (victim->n + 1) / 2;
+  r = victim->freelist;
+  pp = &victim->freelist;
+  for(i = 0; i < n && *pp; i++)
+    pp = &(*pp)->next;
+  victim->freelist = *pp;
+  *pp = 0;
+  victim->n -= i;
+  release(&victim->lock);
+
+  if(r == 0)
+    return 0;
+  rest = r->next;
+  if(rest){
+    acquire(&c->lock);
+    *pp = c->freelist;   // pp points at the last stolen page's next
+    c->freelist = rest;
+    c->n += i - 1;
+    release(&c->lock);
+  }
+  return r;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc().
+// The page is freed when the last reference goes.
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kcache *c;
+  int ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  ref = __sync_sub_and_fetch(&kmem.ref[PA2REF(pa)], 1);
+  if(ref < 0)
+    panic("kfree ref");
+  if(ref > 0)
+    return;
+
+#if KJUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  c = &kcache[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  c->n++;
+  if(c->n > 2*KBATCH)
+    kdrain(c);
+  release(&c->lock);
+  pop_off();
+}
+
+// Take a free page off this cpu's cache, or the global
+// pool, or another cpu's cache, in that order.
+static struct run*
+kget(void)
+{
+  struct run *r;
+  struct kcache *c;
+
+  push_off();
+  c = &kcache[cpuid()];
+  acquire(&c->lock);
+  if(c->freelist == 0)
+    krefill(c);
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->n--;
+  }
+  release(&c->lock);
+  if(r == 0)
+    r = ksteal(c);
+  pop_off();
+
+  if(r)
+    kmem.ref[PA2REF(r)] = 1;
+  return r;
+}
+
+// Take a page from the zeroed pool, or 0 if it is empty.
+static struct run*
+kgetzero(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,13 +315,67 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  if((r = kget()) == 0)
+    return (void*)kgetzero();
+#if KJUNK
+  memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+// Allocate one page of physical memory, filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if((r = kgetzero()) == 0 && (r = kget()) != 0)
+    memset((char*)r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Zero one free page into the zeroed pool, if it
+// is not full. Called by idle cpus, with interrupts
+// enabled. Returns 1 if it zeroed a page.
+int
+kzero_fill(void)
+{
+  struct run *r;
+
+  if(kzero.n >= KZEROMAX)
+    return 0;
+  if((r = kget()) == 0)
+    return 0;
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if(kzero.n < KZEROMAX){
+    r->next = kzero.freelist;
+    kzero.freelist = r;
+    kzero.n++;
+    r = 0;
+  }
+  release(&kzero.lock);
+  if(r)
+    kfree(r);
+  return 1;
+}
+
+// Add a reference to a page that kalloc() returned,
+// for another page table that maps it.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+
+  __sync_fetch_and_add(&kmem.ref[PA2REF(pa)], 1);
+}
+
+// How many references there are to a page.
+int
+krefs(void *pa)
+{
+  return __atomic_load_n(&kmem.ref[PA2REF(pa)], __ATOMIC_SEQ_CST);
+}
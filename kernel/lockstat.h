@@ -0,0 +1,13 @@
+// Spinlock statistics, kept per lock name: all the locks
+// initialized with the same name share one entry.
+// The kernel and user programs use this header file.
+
+#define NLOCKSTAT 64
+
+struct lockstat {
+  char name[16];
+  uint64 nacquire;  // acquisitions
+  uint64 ncontend;  // acquisitions that had to spin
+  uint64 nspin;     // spin iterations while contended
+  uint64 maxhold;   // longest hold, in time CSR ticks
+};
@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "timer.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -19,37 +20,101 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the commit thread has taken the transaction.
 //
-// The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// Commits are done by a kernel process, logd, so end_op()
+// never waits for the disk, and one commit carries the
+// updates of all the system calls that ended since the last.
+// logd copies the transaction's blocks aside (a moment in
+// which begin_op() waits), and then new system calls build
+// the next transaction while logd writes the copy to disk.
+//
+// The log is a physical re-do log containing disk blocks,
+// in two regions that take turns, so that one transaction
+// can be committed while the previous one waits to be
+// installed. Until then the blocks stay pinned in the
+// buffer cache, marked dirty: their home locations are
+// older than the last commit. logd installs a region once
+// it has been committed for FLUSHDELAY ticks, or sooner if
+// it needs the region, and skips the blocks that the other
+// region has committed again since, which it will install
+// in their place. So a block that every transaction
+// rewrites, such as a bitmap or inode block, goes to its
+// home location about once per FLUSHDELAY instead of once
+// per commit.
+// The on-disk format of each region:
+//   header block, containing a sequence number and
+//     block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Recovery installs the committed regions in sequence order.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int seq;
+  int block[MAXLOG];
+};
+
+#define FLUSHDELAY 10  // ticks a commit waits before it is installed
+
+enum { LOG_FREE, LOG_COMMITTED };
+
+// a region of the on-disk log.
+struct logregion {
+  int start;                  // header block; the data follow
+  int state;                  // LOG_COMMITTED: not installed yet
+  uint committed;             // ticks when it was
+  struct logheader lh;
+  struct buf *snap[MAXLOG];   // the blocks as of the commit; not in the cache
+  struct buf *pinned[MAXLOG]; // the cache's copies, pinned until installed
 };
 
 struct log {
   struct spinlock lock;
-  int start;
-  int size;
+  int size;        // data blocks in each region
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // logd is copying the transaction, please wait.
   int dev;
-  struct logheader lh;
+  int seq;         // of the last commit
+  int next;        // region the next commit goes to
+  struct logheader lh;  // the transaction being built
+  struct logregion region[2];
+  struct timer timer;   // logd sleeps on it, under tickslock
+  int kicked;           // end_op() woke logd; under tickslock
+
+  // how well log_write() absorbs rewrites, for tuning the
+  // log size; printed by logdump().
+  uint nnew;       // blocks added to a transaction
+  uint nabsorbed;  // writes of a block already in the transaction
+  uint ncommit;    // transactions committed
+  uint ninstalled; // blocks written to their home locations
+  uint nskipped;   // installs left to a later commit
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void logd(void);
+static void logkick(void);
+
+// Give each region somewhere to keep its copies: struct bufs
+// that are not in the buffer cache, several to a page.
+static void
+allocsnap(struct logregion *r)
+{
+  char *pg = 0;
+  int i, per = PGSIZE / sizeof(struct buf);
+
+  for (i = 0; i < log.size; i++) {
+    if (i % per == 0 && (pg = kalloc()) == 0)
+      panic("initlog: kalloc");
+    r->snap[i] = (struct buf*)pg + i % per;
+    memset(r->snap[i], 0, sizeof(struct buf));
+  }
+}
 
 void
 initlog(int dev, struct superblock *sb)
@@ -58,56 +123,148 @@ initlog(int dev, struct superblock *sb)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
-  log.start = sb->logstart;
-  log.size = sb->nlog;
+  // mkfs chose the size. each transaction's blocks stay
+  // pinned in the buffer cache until installed, and up
+  // to three transactions can be around at once.
+  log.size = sb->nlog/2 - 1;
+  if (log.size > MAXLOG)
+    log.size = MAXLOG;
+  if (log.size > NBUF/4)
+    log.size = NBUF/4;
+  if (log.size < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  log.region[0].start = sb->logstart;
+  log.region[1].start = sb->logstart + sb->nlog/2;
   log.dev = dev;
+  allocsnap(&log.region[0]);
+  allocsnap(&log.region[1]);
   recover_from_log();
+  kproc(logd, "logd");
 }
 
-// Copy committed blocks from log to their home location
+// Sort a region's blocks by home block number, keeping
+// each one's copy and cache buf with it, so that installing
+// them sweeps the disk in order. Only once the log itself
+// has been written or read, which needs them in log order.
 static void
-install_trans(int recovering)
-{
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+sort_trans(struct logregion *r)
+{
+  int i, j, bn;
+  struct buf *snap, *pinned;
+
+  for (i = 1; i < r->lh.n; i++) {
+    bn = r->lh.block[i];
+    snap = r->snap[i];
+    pinned = r->pinned[i];
+    for (j = i; j > 0 && r->lh.block[j-1] > bn; j--) {
+      r->lh.block[j] = r->lh.block[j-1];
+      r->snap[j] = r->snap[j-1];
+      r->pinned[j] = r->pinned[j-1];
+    }
+    r->lh.block[j] = bn;
+    r->snap[j] = snap;
+    r->pinned[j] = pinned;
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Point a committed region's copies at their home locations,
+// in block order.
+static void
+home_trans(struct logregion *r)
+{
+  int i;
+
+  sort_trans(r);
+  for (i = 0; i < r->lh.n; i++)
+    r->snap[i]->blockno = r->lh.block[i];
+}
+
+// Write the n bufs in bs to disk as one batch through the
+// disk queue.
 static void
-read_head(void)
+write_home(struct buf **bs, int n)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  int i;
+
+  virtio_disk_start(bs, n, 1, 0);
+  for (i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
+}
+
+// Copy a committed region's blocks from the log on disk to
+// their home locations.
+static void
+recover_trans(struct logregion *r)
+{
+  int i;
+
+  for (i = 0; i < r->lh.n; i++)
+    r->snap[i]->blockno = r->start+i+1; // log block
+  virtio_disk_rwv(r->snap, r->lh.n, 0);
+  home_trans(r);
+  write_home(r->snap, r->lh.n);
+}
+
+// Copy a committed region's dirty blocks to their home
+// locations from the copies logd took, except those that a
+// later commit holds: the later region installs them, and
+// recovery replays it after this one. Then let the cache
+// recycle the blocks. Only logd sets b->seq and b->dirty,
+// so it can read them without b's lock.
+static void
+install_trans(struct logregion *r)
+{
+  struct buf *b, *bs[MAXLOG];
+  int i, n;
+
+  n = 0;
+  for (i = 0; i < r->lh.n; i++) {
+    b = r->pinned[i];
+    if (b->dirty && b->seq == r->lh.seq)
+      bs[n++] = r->snap[i];
+  }
+  write_home(bs, n);
+  log.ninstalled += n;
+  log.nskipped += r->lh.n - n;
+
+  for (i = 0; i < r->lh.n; i++) {
+    b = r->pinned[i];
+    if (b->seq == r->lh.seq)
+      b->dirty = 0;
+    bunpin(b);
+  }
+}
+
+// Read a region's header from disk
+static void
+read_head(struct logregion *r)
+{
+  struct buf *buf = bread(log.dev, r->start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  if (lh->n > log.size)
+    panic("read_head: log too big");
+  r->lh.n = lh->n;
+  r->lh.seq = lh->seq;
+  for (i = 0; i < r->lh.n; i++) {
+    r->lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write a region's header to disk.
 // This is the true point at which the
-// current transaction commits.
+// region's transaction commits.
 static void
-write_head(void)
+write_head(struct logregion *r)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.dev, r->start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = r->lh.n;
+  hb->seq = r->lh.seq;
+  for (i = 0; i < r->lh.n; i++) {
+    hb->block[i] = r->lh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -116,10 +273,22 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct logregion *r;
+  int i, first;
+
+  for (i = 0; i < 2; i++)
+    read_head(&log.region[i]);
+  // the older commit goes first.
+  first = log.region[1].lh.seq < log.region[0].lh.seq;
+  for (i = 0; i < 2; i++) {
+    r = &log.region[first ^ i];
+    if (r->lh.seq > log.seq)
+      log.seq = r->lh.seq;
+    recover_trans(r); // if committed, copy from log to disk
+    r->lh.n = 0;
+    write_head(r); // clear the log
+    r->state = LOG_FREE;
+  }
 }
 
 // called at the start of each FS system call.
@@ -130,7 +299,7 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.size){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -142,69 +311,166 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// hands the transaction to logd if this was the last
+// outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  if(log.outstanding == 0)
+    logkick();
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
-  }
+// Write a region's copies of the modified blocks to the log.
+// The log blocks are adjacent, so they go in multi-block
+// requests.
+static void
+write_log(struct logregion *r)
+{
+  int i;
+
+  for (i = 0; i < r->lh.n; i++)
+    r->snap[i]->blockno = r->start+i+1; // log block
+  virtio_disk_rwv(r->snap, r->lh.n, 1);
+}
+
+// The committed region with the oldest transaction, or 0.
+// Caller holds log.lock.
+static struct logregion*
+oldest(void)
+{
+  struct logregion *r, *o = 0;
+
+  for (r = log.region; r < &log.region[2]; r++)
+    if (r->state == LOG_COMMITTED && (o == 0 || r->lh.seq < o->lh.seq))
+      o = r;
+  return o;
 }
 
-// Copy modified blocks from cache to log.
+// Install r and free it for another commit.
 static void
-write_log(void)
+install(struct logregion *r)
 {
-  int tail;
+  install_trans(r);    // Now install writes to home locations
+  r->lh.n = 0;
+  write_head(r);       // Erase the transaction from the log
+  acquire(&log.lock);
+  r->state = LOG_FREE;
+  release(&log.lock);
+}
+
+// Take the transaction being built, copy its blocks aside,
+// and let system calls start the next one.
+// Caller holds log.lock; outstanding is 0.
+static void
+snapshot(struct logregion *r)
+{
+  struct buf *b;
+  int i;
+
+  log.committing = 1;
+  r->lh = log.lh;
+  r->lh.seq = ++log.seq;
+  release(&log.lock);
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (i = 0; i < r->lh.n; i++) {
+    b = bread(log.dev, r->lh.block[i]); // cache block, pinned
+    memmove(r->snap[i]->data, b->data, BSIZE);
+    r->pinned[i] = b;
+    b->seq = r->lh.seq;
+    b->dirty = 1;
+    brelse(b);
   }
+
+  acquire(&log.lock);
+  log.lh.n = 0;
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Wake logd: a transaction may be ready to commit.
+// Caller holds log.lock.
+static void
+logkick(void)
+{
+  acquire(&tickslock);
+  log.kicked = 1;
+  wakeup(&log.timer);
+  release(&tickslock);
+}
+
+// Wait for logkick(), or until ticks reaches when if
+// timed is set.
+static void
+logwait(int timed, uint when)
+{
+  acquire(&tickslock);
+  if (timed)
+    timer_add(&log.timer, when);
+  while (!log.kicked && (!timed || log.timer.pending))
+    sleep(&log.timer, &tickslock);
+  log.kicked = 0;
+  timer_del(&log.timer);
+  release(&tickslock);
 }
 
+// The commit thread, which also installs commits once
+// they are old enough.
 static void
-commit()
-{
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+logd(void)
+{
+  struct logregion *r;
+
+  acquire(&log.lock);
+  for(;;){
+    if (log.lh.n == 0 || log.outstanding > 0) {
+      // nothing to commit yet: install, or wait.
+      r = oldest();
+      release(&log.lock);
+      if (r && ticks - r->committed >= FLUSHDELAY)
+        install(r);
+      else
+        logwait(r != 0, r ? r->committed + FLUSHDELAY : 0);
+      acquire(&log.lock);
+      continue;
+    }
+
+    r = &log.region[log.next];
+    if (r->state == LOG_COMMITTED) {
+      // the region is still waiting to be installed;
+      // it has the oldest commit, so installing it first
+      // keeps the home locations in commit order.
+      release(&log.lock);
+      install(oldest());
+      acquire(&log.lock);
+      continue;
+    }
+
+    snapshot(r);
+    write_log(r);     // Write the copies to the log
+    write_head(r);    // Write header to disk -- the real commit
+    home_trans(r);
+
+    acquire(&log.lock);
+    r->state = LOG_COMMITTED;
+    r->committed = ticks;
+    log.next ^= 1;
+    log.ncommit++;
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// logd will do the disk writes.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,7 +483,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -230,7 +496,20 @@ log_write(struct buf *b)
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
     log.lh.n++;
-  }
+    log.nnew++;
+  } else
+    log.nabsorbed++;
   release(&log.lock);
 }
 
+// Print the log's size and write counts. Runs when user
+// types ^P on console. No lock, to avoid wedging a stuck
+// machine further.
+void
+logdump(void)
+{
+  printf("log: %d blocks/transaction, %d commits, %d blocks logged, %d writes absorbed\n",
+         log.size, log.ncommit, log.nnew, log.nabsorbed);
+  printf("log: %d blocks installed, %d left to a later commit\n",
+         log.ninstalled, log.nskipped);
+}
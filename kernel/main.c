@@ -18,24 +18,33 @@ main()
     printf("\n");
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
+    vdsoinit();      // page shared read-only with user space
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
+    profinit();      // sampling profiler
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    dcacheinit();    // name cache
+    pagecacheinit(); // executable page cache
+    shminit();       // shared-memory segments
     fileinit();      // file table
+    pipeinit();      // pipe allocator
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    kloginit();      // kernel log daemon
     __sync_synchronize();
     started = 1;
+    kinithart();     // free the rest of memory, with the other harts
   } else {
     while(started == 0)
       ;
     __sync_synchronize();
     printf("hart %d starting\n", cpuid());
+    kinithart();      // free a share of memory
     kvminithart();    // turn on paging
     trapinithart();   // install kernel trap vector
     plicinithart();   // ask PLIC for device interrupts
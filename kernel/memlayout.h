@@ -29,6 +29,7 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define TIMER_INTERVAL 1000000 // cycles per tick; about 1/10th second in qemu.
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -62,6 +63,15 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap() regions, growing down from MMAPTOP
+//   a guard page
+//   SIGTRAMP (user signal handlers return through it)
+//   UPROC (read-only: the process's struct vproc)
+//   USHARED (read-only: struct vdso, the same in every process)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USHARED (TRAPFRAME - PGSIZE)
+#define UPROC (USHARED - PGSIZE)
+#define SIGTRAMP (UPROC - PGSIZE)
+#define MMAPTOP (SIGTRAMP - PGSIZE)
@@ -0,0 +1,442 @@
+//
+// mmap() and munmap(): regions of user memory backed by a
+// file or by zeroed memory. A region only records what it
+// maps (struct vma in proc.h); its pages are read in when
+// they are first touched, by mmappagein() from uvmfault().
+//
+// Regions are placed below MMAPTOP, the highest free gap
+// first, so the heap can grow up towards them.
+//
+// MAP_PRIVATE pages are the process's own: stores never
+// reach the file, and fork() shares them copy-on-write like
+// the rest of memory. MAP_SHARED pages are shared with
+// forked children, and pages that were stored to are
+// written back to the file when they are unmapped, by
+// munmap(), exec() or exit(). Two processes that map the
+// same file separately each have their own copy.
+//
+// A shared-memory segment attached with shmat() is a
+// MAP_SHARED region whose pages come from the segment
+// (see shm.c), so every process attaching it sees them.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// PTE permissions for the pages of v.
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// The region that va is in, or 0.
+// Caller holds p->lock.
+static struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->addr && va >= v->addr && va < v->addr + v->len)
+      return v;
+  }
+  return 0;
+}
+
+// The lowest address used by a region, or MMAPTOP;
+// the heap must stay below it.
+uint64
+mmaplow(struct proc *p)
+{
+  struct vma *v;
+  uint64 low = MMAPTOP;
+
+  acquire(&p->lock);
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->addr && v->addr < low)
+      low = v->addr;
+  }
+  release(&p->lock);
+  return low;
+}
+
+// Add a region for len bytes of f or s from offset off, or
+// of zeroed memory if both are 0, to the current process.
+// Takes over the caller's reference to s, and takes a new
+// reference to f. Returns the address, or -1.
+static uint64
+vmaalloc(uint64 len, int prot, int flags, struct file *f, uint off, struct shm *s)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free, *o;
+  uint64 start, end;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || len > MMAPTOP)
+    return -1;
+
+  acquire(&p->lock);
+  free = 0;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->addr == 0){
+      free = v;
+      break;
+    }
+  }
+  if(free == 0){
+    release(&p->lock);
+    return -1;
+  }
+
+  // move down past each region in the way.
+  end = MMAPTOP;
+  for(;;){
+    if(end < len || end - len < PGROUNDUP(p->sz)){
+      release(&p->lock);
+      return -1;
+    }
+    start = end - len;
+    for(o = p->vmas; o < &p->vmas[NVMA]; o++){
+      if(o->addr && o->addr < end && o->addr + o->len > start)
+        break;
+    }
+    if(o == &p->vmas[NVMA])
+      break;
+    end = o->addr;
+  }
+
+  free->addr = start;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = f ? filedup(f) : 0;
+  free->off = off;
+  free->shm = s;
+  release(&p->lock);
+  return start;
+}
+
+// Map len bytes of f from offset off, or zeroed memory if
+// f is 0, into the current process. f has been checked
+// against prot and flags. Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  return vmaalloc(len, prot, flags, f, off, 0);
+}
+
+// Map all len bytes of shared-memory segment s into the
+// current process, for shmat(). Takes over the caller's
+// reference to s if it succeeds. Returns the address, or -1.
+uint64
+mmapshm(struct shm *s, uint64 len)
+{
+  return vmaalloc(len, PROT_READ|PROT_WRITE, MAP_SHARED, 0, 0, s);
+}
+
+// Write the pages from va to end of a MAP_SHARED region
+// that were stored to back to the file, then unmap them.
+// v is a copy of the region, no longer in p->vmas.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 end)
+{
+  struct inode *ip;
+  pte_t *pte;
+  uint64 a;
+  uint off;
+  int n;
+
+  if(v->f && (v->flags & MAP_SHARED) && (v->prot & PROT_WRITE)){
+    ip = v->f->ip;
+    for(a = va; a < end; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0 ||
+         (*pte & PTE_D) == 0)
+        continue;
+      off = v->off + (a - v->addr);
+      begin_op();
+      ilock(ip);
+      // don't make the file longer than it was.
+      if(off < ip->size){
+        n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+        writei(ip, 0, PTE2PA(*pte), off, n);
+      }
+      iunlock(ip);
+      end_op();
+    }
+  }
+  uvmunmap(p->pagetable, va, (end - va) / PGSIZE, 1);
+  tlbstale(p);
+}
+
+// Unmap whatever part of p's regions lies between addr and
+// addr+len, splitting a region if the range is inside it.
+// Returns 0, or -1 if a split needed a free slot and there
+// was none.
+static int
+unmap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v, *o, old;
+  uint64 start, end;
+  struct file *f;
+  struct shm *s;
+
+  for(;;){
+    acquire(&p->lock);
+    for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+      if(v->addr && v->addr < addr + len && v->addr + v->len > addr)
+        break;
+    }
+    if(v == &p->vmas[NVMA]){
+      release(&p->lock);
+      return 0;
+    }
+
+    old = *v;
+    start = addr > v->addr ? addr : v->addr;
+    end = addr + len < v->addr + v->len ? addr + len : v->addr + v->len;
+    f = 0;
+    s = 0;
+    if(start == v->addr && end == v->addr + v->len){
+      f = v->f;
+      s = v->shm;
+      v->addr = 0;
+      v->f = 0;
+      v->shm = 0;
+    } else if(start == v->addr){
+      v->off += end - v->addr;
+      v->len -= end - v->addr;
+      v->addr = end;
+    } else if(end == v->addr + v->len){
+      v->len = start - v->addr;
+    } else {
+      for(o = p->vmas; o < &p->vmas[NVMA]; o++){
+        if(o->addr == 0)
+          break;
+      }
+      if(o == &p->vmas[NVMA]){
+        release(&p->lock);
+        return -1;
+      }
+      *o = *v;
+      o->off += end - v->addr;
+      o->len = v->addr + v->len - end;
+      o->addr = end;
+      if(o->f)
+        filedup(o->f);
+      if(o->shm)
+        shmdup(o->shm);
+      v->len = start - v->addr;
+    }
+    release(&p->lock);
+
+    vmaunmap(p, &old, start, end);
+    if(f)
+      fileclose(f);
+    if(s)
+      shmput(s);
+  }
+}
+
+// Unmap addr to addr+len in the current process.
+int
+munmap(uint64 addr, uint64 len)
+{
+  if(addr % PGSIZE || len == 0 || addr + len < addr)
+    return -1;
+  return unmap(myproc(), addr, PGROUNDUP(len));
+}
+
+// Detach the shared-memory segment attached at addr.
+int
+shmdetach(uint64 addr)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 len;
+
+  acquire(&p->lock);
+  v = vmafind(p, addr);
+  if(v == 0 || v->shm == 0 || v->addr != addr){
+    release(&p->lock);
+    return -1;
+  }
+  len = v->len;
+  release(&p->lock);
+  return unmap(p, addr, len);
+}
+
+// Unmap all of p's regions, for exec() and exit().
+// No other thread of p may be running.
+void
+mmapclear(struct proc *p)
+{
+  unmap(p, 0, MMAPTOP);
+}
+
+// Fault in every page of p's MAP_SHARED regions, so that
+// fork() can share them with the child; a page the child
+// faulted in for itself would be its own. May sleep.
+int
+mmapshare(struct proc *p)
+{
+  struct vma *v;
+  uint64 a, end;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    acquire(&p->lock);
+    a = v->addr;
+    end = v->addr + v->len;
+    if((v->flags & MAP_SHARED) == 0 || (v->prot & (PROT_READ|PROT_WRITE)) == 0 ||
+       v->shm)
+      a = end;
+    release(&p->lock);
+    for(; a < end; a += PGSIZE){
+      if(uvmfault(p->pagetable, a, p->sz, 0) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Copy p's regions into np, which fork() has just made:
+// MAP_SHARED pages are mapped in both, and MAP_PRIVATE
+// pages are shared copy-on-write, or copied if eager is
+// set, like uvmcopy().
+// Returns 0, or -1 with nothing copied.
+// np->lock is held.
+int
+mmapfork(struct proc *p, struct proc *np, int eager)
+{
+  struct vma *v;
+
+  acquire(&p->lock);
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->addr == 0)
+      continue;
+    if(uvmcopyrange(p->pagetable, np->pagetable, v->addr, v->addr + v->len,
+                    v->flags & MAP_SHARED, eager) < 0)
+      goto err;
+    np->vmas[v - p->vmas] = *v;
+    if(v->f)
+      filedup(v->f);
+    if(v->shm)
+      shmdup(v->shm);
+  }
+  release(&p->lock);
+  return 0;
+
+ err:
+  // p still holds a reference to each file,
+  // so these closes don't sleep.
+  for(v = np->vmas; v < &np->vmas[NVMA]; v++){
+    if(v->addr == 0)
+      continue;
+    uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+    if(v->f)
+      fileclose(v->f);
+    if(v->shm)
+      shmput(v->shm);
+    v->addr = 0;
+    v->f = 0;
+    v->shm = 0;
+  }
+  release(&p->lock);
+  return -1;
+}
+
+// Called by uvmfault() for a page at va, at or above p->sz,
+// that isn't mapped yet. If va is in a region, set *page to
+// a page holding its contents and return the PTE
+// permissions to map it with. Returns 0 if va isn't in a
+// region, or -1 if the access isn't allowed, memory ran
+// out, or reading the file would have had to sleep while
+// the caller holds a spinlock. The caller may hold p->lock
+// (the signal code copies frames under it), which keeps
+// the regions as they are.
+int
+mmappagein(pagetable_t pagetable, uint64 va, int write, char **page)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct file *f;
+  struct inode *ip;
+  uint off;
+  int perm, n, locked, held;
+  char *mem;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return 0;
+  locked = holdingany();
+  if((held = holding(&p->lock)) == 0)
+    acquire(&p->lock);
+  if((v = vmafind(p, va)) == 0){
+    if(!held)
+      release(&p->lock);
+    return 0;
+  }
+  perm = vmaperm(v);
+  if((perm & PTE_R) == 0 || (write && (perm & PTE_W) == 0) ||
+     (v->f && locked)){
+    if(!held)
+      release(&p->lock);
+    return -1;
+  }
+  off = v->off + (va - v->addr);
+  if(v->shm){
+    // the region's reference keeps the segment.
+    mem = shmpage(v->shm, off / PGSIZE);
+    if(!held)
+      release(&p->lock);
+    if(mem == 0)
+      return -1;
+    *page = mem;
+    return perm | PTE_A;
+  }
+  // we may sleep, so the last fileclose()
+  // of this reference may too.
+  f = v->f ? filedup(v->f) : 0;
+  if(!held)
+    release(&p->lock);
+
+  if((mem = kalloc_zeroed()) == 0){
+    if(f)
+      fileclose(f);
+    return -1;
+  }
+  if(f){
+    ip = f->ip;
+    ilockshared(ip);
+    if(off < ip->size){
+      n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+      if(readi(ip, 0, (uint64)mem, off, n) != n){
+        iunlock(ip);
+        fileclose(f);
+        kfree(mem);
+        return -1;
+      }
+    }
+    iunlock(ip);
+    fileclose(f);
+  }
+  *page = mem;
+  // a store is about to dirty the page.
+  return write ? perm | PTE_A | PTE_D : perm | PTE_A;
+}
@@ -0,0 +1,187 @@
+// Page cache for executables.
+//
+// Holds whole pages of program text, keyed by (dev, inum,
+// file offset), so that every process running a program
+// maps the same physical pages instead of reading its own
+// copy; see execpagein(). The cache holds one reference
+// (see kdup()) to each page, and each mapping another, so
+// an evicted page lives on in the processes using it.
+// Processes map the pages copy-on-write.
+//
+// Pages are entered with the inode locked shared, and
+// writei() and truncate() purge the inode's pages with it
+// locked exclusively, so a stale page can't be entered
+// after a purge. ip->pcached says whether there may be
+// pages to purge; iget() purges when it recycles an inode
+// slot that still says so.
+// pagecache.lock protects the table itself.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCPAGE  128
+#define NCPHASH 61
+
+struct cpage {
+  uint dev;
+  uint inum;          // 0 if the entry is unused
+  uint off;           // file offset of the page
+  char *pa;
+  struct cpage *hnext; // hash chain, hashed by (dev, inum)
+  struct cpage *prev;  // LRU list, least recently used at lru.prev
+  struct cpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage cpage[NCPAGE];
+  struct cpage *hash[NCPHASH];
+  struct cpage lru;
+} pagecache;
+
+static int
+phash(uint dev, uint inum)
+{
+  return (dev * 131 + inum) % NCPHASH;
+}
+
+// Move c to the most recently used end of the LRU list.
+static void
+ptouch(struct cpage *c)
+{
+  c->next->prev = c->prev;
+  c->prev->next = c->next;
+  c->next = pagecache.lru.next;
+  c->prev = &pagecache.lru;
+  pagecache.lru.next->prev = c;
+  pagecache.lru.next = c;
+}
+
+// Move c to the least recently used end, to be reused first.
+static void
+pdemote(struct cpage *c)
+{
+  c->next->prev = c->prev;
+  c->prev->next = c->next;
+  c->prev = pagecache.lru.prev;
+  c->next = &pagecache.lru;
+  pagecache.lru.prev->next = c;
+  pagecache.lru.prev = c;
+}
+
+// Take c off its hash chain, drop its page, and mark it
+// unused.
+static void
+punhash(struct cpage *c)
+{
+  struct cpage **pp;
+
+  if(c->inum == 0)
+    return;
+  for(pp = &pagecache.hash[phash(c->dev, c->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == c){
+      *pp = c->hnext;
+      break;
+    }
+  }
+  kfree(c->pa);
+  c->pa = 0;
+  c->inum = 0;
+}
+
+// Find the entry for the page at off. Caller holds
+// pagecache.lock.
+static struct cpage*
+pfind(uint dev, uint inum, uint off)
+{
+  struct cpage *c;
+
+  for(c = pagecache.hash[phash(dev, inum)]; c; c = c->hnext){
+    if(c->dev == dev && c->inum == inum && c->off == off)
+      return c;
+  }
+  return 0;
+}
+
+void
+pagecacheinit(void)
+{
+  struct cpage *c;
+
+  initlock(&pagecache.lock, "pagecache");
+  pagecache.lru.prev = &pagecache.lru;
+  pagecache.lru.next = &pagecache.lru;
+  for(c = pagecache.cpage; c < pagecache.cpage+NCPAGE; c++){
+    c->next = pagecache.lru.next;
+    c->prev = &pagecache.lru;
+    pagecache.lru.next->prev = c;
+    pagecache.lru.next = c;
+  }
+}
+
+// Return the cached page of inode inum at file offset off,
+// with a reference added for the caller, or 0.
+char*
+pagecache_lookup(uint dev, uint inum, uint off)
+{
+  struct cpage *c;
+  char *pa;
+
+  acquire(&pagecache.lock);
+  if((c = pfind(dev, inum, off)) == 0){
+    release(&pagecache.lock);
+    return 0;
+  }
+  ptouch(c);
+  pa = c->pa;
+  kdup(pa);
+  release(&pagecache.lock);
+  return pa;
+}
+
+// Remember that pa holds the page of inode inum at off.
+// The cache takes its own reference. Caller holds the
+// inode's lock.
+void
+pagecache_enter(uint dev, uint inum, uint off, char *pa)
+{
+  struct cpage *c;
+  int h;
+
+  acquire(&pagecache.lock);
+  if(pfind(dev, inum, off) == 0){
+    c = pagecache.lru.prev;
+    punhash(c);
+    c->dev = dev;
+    c->inum = inum;
+    c->off = off;
+    c->pa = pa;
+    kdup(pa);
+    h = phash(dev, inum);
+    c->hnext = pagecache.hash[h];
+    pagecache.hash[h] = c;
+    ptouch(c);
+  }
+  release(&pagecache.lock);
+}
+
+// Forget every page of inode inum, which is changing or
+// going away.
+void
+pagecache_purge(uint dev, uint inum)
+{
+  struct cpage *c, *next;
+
+  acquire(&pagecache.lock);
+  for(c = pagecache.hash[phash(dev, inum)]; c; c = next){
+    next = c->hnext;
+    if(c->dev == dev && c->inum == inum){
+      punhash(c);
+      pdemote(c);
+    }
+  }
+  release(&pagecache.lock);
+}
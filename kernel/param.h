@@ -1,13 +1,47 @@
+#ifndef UARTHART
+#define UARTHART      0  // hart that takes console interrupts
+#endif
+#ifndef DISKHART
+#define DISKHART     -1  // same for the disk; -1 for the hart that started the I/O
+#endif
+#ifndef NPROC
 #define NPROC        64  // maximum number of processes
+#endif
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#ifndef NOFILE
+#define NOFILE      512  // open files per process; a page of pointers at most
+#endif
+#define NOFILE0      16  // open files before a process's table grows
+#ifndef NFILE
+#define NFILE      1000  // open files per system
+#endif
+#ifndef NINODE
+#define NINODE      200  // maximum number of active and cached i-nodes
+#endif
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#ifndef LOGSIZE
+#define LOGSIZE      (MAXOPBLOCKS*3)  // default data blocks in a log transaction
+#endif
+#ifndef NBUF
+#define NBUF         (LOGSIZE*4)  // size of disk block cache
+#endif
+#ifndef FSSIZE
+#define FSSIZE       200000  // size of file system in blocks
+#endif
 #define MAXPATH      128   // maximum file path name
+#define NICE_MIN     -20  // nice levels: negative for more cpu time
+#define NICE_MAX      19
+#define MAXQUANTUM   100  // most clock ticks a thread runs before yielding
+#define NSYSCALL      64   // system call numbers are below this
+#ifndef LOCKSTAT
+#define LOCKSTAT     0     // count spinlock acquisitions and contention
+#endif
+#ifndef SYSSTAT
+#define SYSSTAT      1     // time system calls, see getstats()
+#endif
+#ifndef KJUNK
+#define KJUNK        1     // fill freed and allocated pages with junk
+#endif
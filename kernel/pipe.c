@@ -7,18 +7,34 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
+#include "poll.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+// the ring is one page, separate from struct pipe, filled
+// and drained with one copyin() or copyout() per contiguous
+// stretch rather than per byte.
+#define PIPESIZE PGSIZE
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // PIPESIZE bytes, from kalloc()
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct pollhead poll;  // poll() calls waiting for a change
 };
 
+// struct pipe is much smaller than a page.
+static struct slabcache pipecache;
+
+void
+pipeinit(void)
+{
+  slabinit(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +44,16 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)slaballoc(&pipecache)) == 0)
+    goto bad;
+  pi->data = 0;
+  if((pi->data = kalloc()) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->poll.first = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -46,8 +66,11 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
+  if(pi){
+    if(pi->data)
+      kfree(pi->data);
+    slabfree(&pipecache, pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,65 +89,118 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwake(&pi->poll);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kfree(pi->data);
+    slabfree(&pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes from addr, a user address if user_src is
+// set, else a kernel one. If nonblock is set, write only
+// what fits, or return -EAGAIN if nothing does.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n, int nonblock)
 {
-  int i = 0;
-  struct proc *pr = myproc();
+  int i = 0, m;
 
   acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || pr->killed){
+    if(pi->readopen == 0 || killed()){
       release(&pi->lock);
       return -1;
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+      if(nonblock){
+        if(i == 0)
+          i = -EAGAIN;
+        break;
+      }
       wakeup(&pi->nread);
+      pollwake(&pi->poll);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      // as much as fits before the ring's end or its oldest byte.
+      m = n - i;
+      if(m > PIPESIZE - (pi->nwrite - pi->nread))
+        m = PIPESIZE - (pi->nwrite - pi->nread);
+      if(m > PIPESIZE - pi->nwrite % PIPESIZE)
+        m = PIPESIZE - pi->nwrite % PIPESIZE;
+      if(either_copyin(&pi->data[pi->nwrite % PIPESIZE], user_src, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
+  pollwake(&pi->poll);
   release(&pi->lock);
 
   return i;
 }
 
+// If nonblock is set, return -EAGAIN rather than wait
+// for a writer.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
-  int i;
+  int i, m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(pr->killed){
+    if(killed()){
       release(&pi->lock);
       return -1;
     }
+    if(nonblock){
+      release(&pi->lock);
+      return -EAGAIN;
+    }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PIPESIZE - pi->nread % PIPESIZE)
+      m = PIPESIZE - pi->nread % PIPESIZE;
+    if(copyout(pr->pagetable, addr + i, &pi->data[pi->nread % PIPESIZE], m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pollwake(&pi->poll);
   release(&pi->lock);
   return i;
 }
+
+// For poll(): what the end of pi that is readable or not
+// can do without blocking. If w isn't 0, also queue it to
+// hear about changes.
+int
+pipepoll(struct pipe *pi, int readable, struct pollwait *w)
+{
+  int m = 0;
+
+  acquire(&pi->lock);
+  if(readable){
+    if(pi->nread != pi->nwrite)
+      m |= POLLIN;
+    if(!pi->writeopen)
+      m |= POLLIN | POLLHUP;
+  } else {
+    if(pi->nwrite != pi->nread + PIPESIZE)
+      m |= POLLOUT;
+    if(!pi->readopen)
+      m |= POLLERR;
+  }
+  if(w)
+    pollqueue(&pi->poll, w);
+  release(&pi->lock);
+  return m;
+}
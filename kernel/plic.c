@@ -2,18 +2,61 @@
 #include "param.h"
 #include "memlayout.h"
 #include "riscv.h"
+#include "spinlock.h"
 #include "defs.h"
 
 //
 // the riscv Platform Level Interrupt Controller (PLIC).
 //
+// each device's interrupts are enabled on one hart only, so
+// the work of serving them stays in that hart's caches.
+// the UART's go to UARTHART. the disk's go to DISKHART, or,
+// if it is -1, follow whichever hart last started a transfer
+// (see plicroute()), so that the completion is handled on
+// the cpu that asked for it, and wakeup() queues the waiting
+// thread there too, since that cpu is the one it last ran on.
+//
+// an interrupt is only moved by the hart serving it, just
+// after plic_complete(): the PLIC ignores a completion from
+// a hart the source is no longer enabled for, which would
+// leave it claimed for good.
+//
+
+#define NIRQ (sizeof(irqs)/sizeof(irqs[0]))
+
+// interrupts handled here, and the hart each goes to;
+// plic_lock protects these and the enable registers.
+// irqwant is where plicroute() last asked each to go.
+static int irqs[] = { UART0_IRQ, VIRTIO0_IRQ };
+static int irqhart[NIRQ];
+static int irqwant[NIRQ];
+static struct spinlock plic_lock;
 
 void
 plicinit(void)
 {
+  initlock(&plic_lock, "plic");
+
   // set desired IRQ priorities non-zero (otherwise disabled).
   *(uint32*)(PLIC + UART0_IRQ*4) = 1;
   *(uint32*)(PLIC + VIRTIO0_IRQ*4) = 1;
+
+  irqhart[0] = irqwant[0] = UARTHART;
+  irqhart[1] = irqwant[1] = DISKHART >= 0 ? DISKHART : 0;
+}
+
+// the enable bits for hart's S-mode. caller holds plic_lock.
+static uint32
+plicenable(int hart)
+{
+  uint32 bits = 0;
+  int i;
+
+  for(i = 0; i < NIRQ; i++){
+    if(irqhart[i] == hart)
+      bits |= 1 << irqs[i];
+  }
+  return bits;
 }
 
 void
@@ -21,13 +64,45 @@ plicinithart(void)
 {
   int hart = cpuid();
   
-  // set uart's enable bit for this hart's S-mode. 
-  *(uint32*)PLIC_SENABLE(hart)= (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
+  // enable the interrupts routed to this hart's S-mode.
+  acquire(&plic_lock);
+  *(uint32*)PLIC_SENABLE(hart) = plicenable(hart);
+  release(&plic_lock);
 
   // set this hart's S-mode priority threshold to 0.
   *(uint32*)PLIC_SPRIORITY(hart) = 0;
 }
 
+// the index of irq in irqs[], if it is steered rather
+// than fixed, or -1.
+static int
+plicsteered(int irq)
+{
+  int i;
+
+  if(irq != VIRTIO0_IRQ || DISKHART >= 0)
+    return -1;
+  for(i = 0; irqs[i] != irq; i++)
+    ;
+  return i;
+}
+
+// send irq's interrupts to the calling hart, once the one
+// being served now, if any, has been completed. called by
+// the disk driver with interrupts off as it starts a
+// transfer.
+void
+plicroute(int irq)
+{
+  int i, hart = cpuid();
+
+  if((i = plicsteered(irq)) < 0)
+    return;
+  // usually the same hart submits again.
+  if(__atomic_load_n(&irqwant[i], __ATOMIC_RELAXED) != hart)
+    __atomic_store_n(&irqwant[i], hart, __ATOMIC_RELAXED);
+}
+
 // ask the PLIC what interrupt we should serve.
 int
 plic_claim(void)
@@ -37,10 +112,23 @@ plic_claim(void)
   return irq;
 }
 
-// tell the PLIC we've served this IRQ.
+// tell the PLIC we've served this IRQ, and then move it
+// if plicroute() asked for that. interrupts are off, so
+// this hart can't claim it again in between.
 void
 plic_complete(int irq)
 {
-  int hart = cpuid();
+  int hart = cpuid(), i, want;
+
   *(uint32*)PLIC_SCLAIM(hart) = irq;
+  if((i = plicsteered(irq)) < 0)
+    return;
+  want = __atomic_load_n(&irqwant[i], __ATOMIC_RELAXED);
+  if(want == irqhart[i])
+    return;
+  acquire(&plic_lock);
+  irqhart[i] = want;
+  *(uint32*)PLIC_SENABLE(hart) = plicenable(hart);
+  *(uint32*)PLIC_SENABLE(want) = plicenable(want);
+  release(&plic_lock);
 }
@@ -0,0 +1,167 @@
+// poll(): wait for any of several file descriptors.
+//
+// Each pollable object has a struct pollhead. poll() asks
+// each file whether it is ready (filepoll()), and while
+// nothing is, the object also puts that descriptor's
+// struct pollwait on its pollhead, under the object's own
+// lock. When a pipe or the console changes, it calls
+// pollwake() under the same lock, which wakes every poll()
+// on its pollhead. So one sleep waits for all the
+// descriptors at once, and a change between the check and
+// the sleep isn't missed.
+//
+// A poll() sleeps on the timer that bounds it, so the
+// pollheads and the wakeup are protected by tickslock, as
+// the timer is.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "timer.h"
+#include "poll.h"
+
+#define NPOLLFD 16  // most descriptors one poll() waits for
+
+struct polltable {
+  struct timer timer;   // also the sleep channel
+  int woken;            // a pollhead changed
+  struct pollwait wait[NPOLLFD];
+};
+
+// Put w on h, for the object that h belongs to, whose
+// lock the caller holds.
+void
+pollqueue(struct pollhead *h, struct pollwait *w)
+{
+  acquire(&tickslock);
+  w->head = h;
+  w->next = h->first;
+  if(w->next)
+    w->next->pprev = &w->next;
+  w->pprev = &h->first;
+  h->first = w;
+  release(&tickslock);
+}
+
+// Caller holds tickslock.
+static void
+polldequeue(struct pollwait *w)
+{
+  if(w->head == 0)
+    return;
+  *w->pprev = w->next;
+  if(w->next)
+    w->next->pprev = w->pprev;
+  w->head = 0;
+}
+
+// The object that owns h may have become ready: wake the
+// poll() calls waiting for it. Caller holds the object's
+// lock, so h->first can't gain an entry meanwhile.
+void
+pollwake(struct pollhead *h)
+{
+  struct pollwait *w;
+
+  if(h->first == 0)
+    return;
+  acquire(&tickslock);
+  for(w = h->first; w; w = w->next){
+    w->pt->woken = 1;
+    wakeup(&w->pt->timer);
+  }
+  release(&tickslock);
+}
+
+// Wait for the nfds struct pollfds at user address addr,
+// for up to timeout clock ticks, or forever if timeout is
+// negative. Returns how many have revents set, 0 if the
+// time ran out, or -1.
+int
+poll(uint64 addr, int nfds, int timeout)
+{
+  struct proc *p = myproc();
+  struct pollfd fds[NPOLLFD];
+  struct file *files[NPOLLFD];
+  struct polltable pt;
+  struct pollwait *w;
+  int i, n, m, expired;
+  struct file *f;
+
+  if(nfds < 0 || nfds > NPOLLFD)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, nfds * sizeof(struct pollfd)) < 0)
+    return -1;
+
+  // hold the files, in case another thread closes them.
+  // p->lock keeps them open until filedup().
+  acquire(&p->lock);
+  for(i = 0; i < nfds; i++){
+    files[i] = 0;
+    if((f = fdfile(p, fds[i].fd)) != 0)
+      files[i] = filedup(f);
+    pt.wait[i].pt = &pt;
+    pt.wait[i].head = 0;
+  }
+  release(&p->lock);
+  pt.woken = 0;
+  pt.timer.pending = 0;
+  if(timeout > 0){
+    acquire(&tickslock);
+    timer_add(&pt.timer, ticks + timeout);
+    release(&tickslock);
+  }
+
+  expired = (timeout == 0);
+  for(;;){
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(files[i] == 0){
+        fds[i].revents = POLLNVAL;
+      } else {
+        // stop queueing once there is an answer.
+        w = (n == 0 && !expired) ? &pt.wait[i] : 0;
+        m = filepoll(files[i], w);
+        fds[i].revents = m & (fds[i].events | POLLERR | POLLHUP);
+      }
+      if(fds[i].revents)
+        n++;
+    }
+    if(n > 0 || expired || killed())
+      break;
+
+    acquire(&tickslock);
+    while(!pt.woken && (timeout < 0 || pt.timer.pending) && !killed())
+      sleep(&pt.timer, &tickslock);
+    expired = timeout > 0 && !pt.timer.pending;
+    pt.woken = 0;
+    for(i = 0; i < nfds; i++)
+      polldequeue(&pt.wait[i]);
+    release(&tickslock);
+  }
+
+  acquire(&tickslock);
+  timer_del(&pt.timer);
+  for(i = 0; i < nfds; i++)
+    polldequeue(&pt.wait[i]);
+  release(&tickslock);
+  for(i = 0; i < nfds; i++){
+    if(files[i])
+      fileclose(files[i]);
+  }
+
+  if(killed())
+    return -1;
+  if(copyout(p->pagetable, addr, (char*)fds, nfds * sizeof(struct pollfd)) < 0)
+    return -1;
+  return n;
+}
@@ -0,0 +1,30 @@
+// poll(): wait until one of several file descriptors is
+// ready. The kernel and user programs use this header file.
+
+#define POLLIN   0x01  // can read without blocking
+#define POLLOUT  0x04  // can write without blocking
+#define POLLERR  0x08  // a pipe's reader has gone (revents only)
+#define POLLHUP  0x10  // a pipe's writer has gone (revents only)
+#define POLLNVAL 0x20  // fd isn't open (revents only)
+
+struct pollfd {
+  int fd;              // ignored if negative
+  short events;        // POLLIN and POLLOUT wanted
+  short revents;       // set by poll()
+};
+
+// What a pollable object (a pipe, the console) keeps:
+// the poll() calls waiting for it to change. Protected
+// by tickslock; see poll.c.
+struct pollhead {
+  struct pollwait *first;
+};
+
+// One file descriptor of a waiting poll() call, on the
+// pollhead of the object it refers to.
+struct pollwait {
+  struct polltable *pt;
+  struct pollhead *head;   // 0 if not waiting
+  struct pollwait *next;
+  struct pollwait **pprev;
+};
@@ -1,6 +1,14 @@
 //
 // formatted console output -- printf, panic.
 //
+// once klogd is running, printf() doesn't wait for the
+// UART: each cpu appends to its own ring, with interrupts
+// off and no lock, and klogd sends whole lines from the
+// rings to the UART. the next clock interrupt wakes klogd,
+// since printf() itself may be called with any lock held.
+// before then, and after a panic, printf() writes straight
+// to the UART.
+//
 
 #include <stdarg.h>
 
@@ -17,14 +25,49 @@
 
 volatile int panicked = 0;
 
-// lock to avoid interleaving concurrent printf's.
+// lock to avoid interleaving concurrent printf's,
+// while they are synchronous.
 static struct {
   struct spinlock lock;
   int locking;
 } pr;
 
+#define KLOGSIZE 2048
+
+// a cpu's log ring. w is only advanced by that cpu's
+// printf(), and r only by klogd, so neither needs a lock.
+struct klog {
+  char buf[KLOGSIZE];
+  uint w;
+  uint r;
+} klog[NCPU];
+
+static struct spinlock kloglock;   // for klogd's sleep
+static int klogready;              // send printf() to the rings
+static volatile int klogpending;   // the rings have new output
+
 static char digits[] = "0123456789abcdef";
 
+// output one character of a printf(), to this cpu's
+// ring, or the console. a full ring drops characters.
+// caller has interrupts off.
+static void
+printc(int c)
+{
+  struct klog *l;
+
+  if(!klogready || !pr.locking){
+    consputc(c);
+    return;
+  }
+  l = &klog[cpuid()];
+  if(l->w - l->r >= KLOGSIZE)
+    return;
+  l->buf[l->w % KLOGSIZE] = c;
+  __sync_synchronize();
+  l->w++;
+}
+
 static void
 printint(int xx, int base, int sign)
 {
@@ -46,17 +89,17 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    printc(buf[i]);
 }
 
 static void
 printptr(uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  printc('0');
+  printc('x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    printc(digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the console. only understands %d, %x, %p, %s.
@@ -67,9 +110,10 @@ printf(char *fmt, ...)
   int i, c, locking;
   char *s;
 
-  locking = pr.locking;
+  locking = pr.locking && !klogready;
   if(locking)
     acquire(&pr.lock);
+  push_off();
 
   if (fmt == 0)
     panic("null fmt");
@@ -77,7 +121,7 @@ printf(char *fmt, ...)
   va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      printc(c);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -97,27 +141,36 @@ printf(char *fmt, ...)
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        printc(*s);
       break;
     case '%':
-      consputc('%');
+      printc('%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      printc('%');
+      printc(c);
       break;
     }
   }
 
+  pop_off();
   if(locking)
     release(&pr.lock);
+  else if(klogready)
+    klogpending = 1;
 }
 
 void
 panic(char *s)
 {
+  struct klog *l;
+
   pr.locking = 0;
+  // what is still in the rings should come out first.
+  for(l = klog; l < &klog[NCPU]; l++)
+    for(; l->r != l->w; l->r++)
+      consputc(l->buf[l->r % KLOGSIZE]);
   printf("panic: ");
   printf(s);
   printf("\n");
@@ -130,5 +183,66 @@ void
 printfinit(void)
 {
   initlock(&pr.lock, "pr");
+  initlock(&kloglock, "klog");
   pr.locking = 1;
 }
+
+// send the finished lines in l to the UART, or all of it
+// if it is nearly full.
+static void
+klogdrain(struct klog *l)
+{
+  char buf[128];
+  uint w, end, n, i;
+
+  w = l->w;
+  __sync_synchronize();
+  for(end = w; end != l->r && l->buf[(end-1) % KLOGSIZE] != '\n'; end--)
+    ;
+  if(end == l->r && w - l->r >= KLOGSIZE/2)
+    end = w;
+  while(l->r != end){
+    n = end - l->r;
+    if(n > sizeof(buf))
+      n = sizeof(buf);
+    for(i = 0; i < n; i++)
+      buf[i] = l->buf[(l->r + i) % KLOGSIZE];
+    __sync_synchronize();
+    l->r += n;
+    uartwrite(buf, n);
+  }
+}
+
+static void
+klogd(void)
+{
+  struct klog *l;
+
+  for(;;){
+    acquire(&kloglock);
+    while(klogpending == 0)
+      sleep(klog, &kloglock);
+    klogpending = 0;
+    release(&kloglock);
+
+    for(l = klog; l < &klog[NCPU]; l++)
+      klogdrain(l);
+  }
+}
+
+// start klogd; from now on printf() doesn't wait for the UART.
+void
+kloginit(void)
+{
+  kproc(klogd, "klogd");
+  klogready = 1;
+}
+
+// called by each clock interrupt: wake klogd if there is
+// new output. clockintr() holds no locks, unlike printf().
+void
+klogkick(void)
+{
+  if(klogpending)
+    wakeup(klog);
+}
@@ -4,59 +4,123 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "procinfo.h"
+#include "vdso.h"
 #include "defs.h"
 
-extern void* callsigret(void);
-extern void* endcallsigret(void);
+extern char sigtramp[]; // trampoline.S
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// processes are allocated as they are first needed, up to
+// NPROC, and then kept for reuse, so that code that looks at
+// a process without holding a lock never sees it freed.
+// proc[0..nproc-1] are in use; proctab_lock serializes
+// adding one.
+struct proc *proc[NPROC];
+int nproc;
+struct spinlock proctab_lock;
 
 struct proc *initproc;
 
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// live processes by pid, so findproc() and kill() needn't
+// scan proc[]; pid_lock protects the chains.
+#define NPIDHASH 64
+static struct proc *pidhash[NPIDHASH];
+
+int nexttid = 1;
+struct spinlock tid_lock;
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void setrunnable(struct kthread *t);
+static void wakethread(struct kthread *t);
+void turnoff_sigbit(struct proc *p, int i);
 
 extern char trampoline[]; // trampoline.S
 
+// a thread that ran within the last MIGRATE_TICKS
+// ticks is assumed to still have a warm cache on its
+// cpu, and is only stolen from a queue with other work.
+#define MIGRATE_TICKS 2
+
+// threads are scheduled fairly, by virtual runtime: the
+// time a thread has spent RUNNING, scaled by the weight of
+// its process's nice level, so that the lighter a thread
+// the faster its vruntime grows. each cpu runs the queued
+// thread with the least vruntime, so runnable threads share
+// a cpu in proportion to their weights, and a thread that
+// mostly sleeps (like sh, waiting for the keyboard) runs
+// soon after it wakes. it can't bank more than
+// SCHED_LATENCY of credit by sleeping, though.
+#define SCHED_LATENCY (2*TIMER_INTERVAL)
+
+// a thread runs for its process's quantum of clock ticks
+// before it yields, unless a waiting thread falls more
+// than SCHED_WAKEUP_GRAN of vruntime behind it first.
+// so a batch job can have a long quantum (fewer switches,
+// warmer caches) and still make way for a woken sh.
+#define SCHED_WAKEUP_GRAN TIMER_INTERVAL
+
+// weights of nice levels NICE_MIN..NICE_MAX, as in Linux:
+// each level gets about 1.25 times the cpu of the next.
+#define NICE0_WEIGHT 1024
+static const int niceweight[NICE_MAX-NICE_MIN+1] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+   9548,  7620,  6100,  4904,  3906,
+   3121,  2501,  1991,  1586,  1277,
+   1024,   820,   655,   526,   423,
+    335,   272,   215,   172,   137,
+    110,    87,    70,    56,    45,
+     36,    29,    23,    18,    15,
+};
+
+// sleeping threads, hashed by wait channel, so that
+// wakeup() only looks at threads that might be
+// sleeping on its chan. a SLEEPING thread is on
+// exactly one queue, and only wakeup() and wakethread()
+// remove it.
+// lock order: the caller's condition lock, then
+// the queue lock, then t->lock.
+#define NWAITQ 67
+struct waitq {
+  struct spinlock lock;
+  struct kthread *head;
+} waitq[NWAITQ];
+
+static struct waitq*
+chanq(void *chan)
+{
+  return &waitq[((uint64)chan >> 3) % NWAITQ];
+}
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl) {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-  }
-}
-
 // initialize the proc table at boot time.
 void
 procinit(void)
 {
-  struct proc *p;
+  struct cpu *c;
+  struct waitq *wq;
   
+  initlock(&proctab_lock, "proctab");
   initlock(&pid_lock, "nextpid");
+  initlock(&tid_lock, "nexttid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->kstack = KSTACK((int) (p - proc));
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    initlock(&c->rqlock, "runqueue");
+    c->minvruntime = SCHED_LATENCY;  // so placing a thread can't go below 0
   }
+  for(wq = waitq; wq < &waitq[NWAITQ]; wq++)
+    initlock(&wq->lock, "waitq");
 }
 
 // Must be called with interrupts disabled,
@@ -78,38 +142,256 @@ mycpu(void) {
   return c;
 }
 
-// Return the current struct proc *, or zero if none.
-struct proc*
-myproc(void) {
+// Return the current struct kthread *, or zero if none.
+struct kthread*
+mythread(void) {
   push_off();
   struct cpu *c = mycpu();
-  struct proc *p = c->proc;
+  struct kthread *t = c->thread;
   pop_off();
-  return p;
+  return t;
+}
+
+// Return the current struct proc *, or zero if none.
+struct proc*
+myproc(void) {
+  struct kthread *t = mythread();
+  return t ? t->proc : 0;
 }
 
+// Should the current thread stop what it is doing
+// and head for exit()? Either its process has been
+// killed or another thread is tearing the process down.
 int
-allocpid() {
-  int pid;
-  
+killed(void)
+{
+  return myproc()->killed || mythread()->killed;
+}
+
+// Each process runs with ASID (its slot + 1), so its TLB
+// entries survive traps and switches to other processes.
+// Whenever the kernel changes or removes one of p's live
+// PTEs, or the slot gets a new process, it calls tlbstale(p);
+// each cpu flushes p's ASID before it next enters p's user
+// space. Other threads of p that are in user space on other
+// cpus keep old entries until their next trap.
+void
+tlbstale(struct proc *p)
+{
+  __sync_fetch_and_add(&p->tlbgen, 1);
+}
+
+// The satp value for entering p's user space on this cpu,
+// after flushing p's ASID if it might be stale here.
+// Interrupts must be disabled.
+uint64
+proc_satp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int i = p->slot, gen;
+
+  if(noasid)
+    return MAKE_SATP(p->pagetable);  // trampoline.S flushes
+  gen = __atomic_load_n(&p->tlbgen, __ATOMIC_SEQ_CST);
+  if(c->tlbgen[i] != gen){
+    sfence_vma_asid(i + 1);
+    c->tlbgen[i] = gen;
+  }
+  return MAKE_SATP_ASID(p->pagetable, i + 1);
+}
+
+// Give p a new pid, and enter it in pidhash[].
+static void
+allocpid(struct proc *p) {
+  struct proc **pp;
+
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  pp = &pidhash[p->pid % NPIDHASH];
+  p->pidnext = *pp;
+  *pp = p;
   release(&pid_lock);
+}
 
-  return pid;
+// Take p out of pidhash[], before its pid is cleared.
+static void
+freepid(struct proc *p) {
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  p->pidnext = 0;
+  release(&pid_lock);
+}
+
+// Make c a child of p. Caller holds wait_lock.
+static void
+addchild(struct proc *p, struct proc *c)
+{
+  c->parent = p;
+  c->sibling = p->children;
+  if(c->sibling)
+    c->sibling->psibling = &c->sibling;
+  c->psibling = &p->children;
+  p->children = c;
+}
+
+// Take c off its parent's list. Caller holds wait_lock.
+static void
+delchild(struct proc *c)
+{
+  *c->psibling = c->sibling;
+  if(c->sibling)
+    c->sibling->psibling = c->psibling;
+  c->parent = 0;
+  c->sibling = 0;
+  c->psibling = 0;
+}
+
+int
+alloctid() {
+  int tid;
+  
+  acquire(&tid_lock);
+  tid = nexttid;
+  nexttid = nexttid + 1;
+  release(&tid_lock);
+
+  return tid;
+}
+
+// Look in p's thread table for an UNUSED thread.
+// If found, initialize state required to run in the kernel,
+// and return it in state USED. Otherwise return 0.
+// p->lock must be held.
+static struct kthread*
+allocthread(struct proc *p)
+{
+  struct kthread *t;
+  char *stack;
+  uint64 va;
+
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++) {
+    acquire(&t->lock);
+    if(t->state == UNUSED)
+      goto found;
+    release(&t->lock);
+  }
+  return 0;
+
+found:
+  // the slot's kernel stack is made the first time it is
+  // used, and kept, since the kernel may still be on it.
+  if(t->kstack == 0){
+    if((stack = kalloc()) == 0){
+      release(&t->lock);
+      return 0;
+    }
+    va = KSTACK(p->slot * NTHREAD + (int)(t - p->threads));
+    if(kvmmapstack(va, (uint64)stack) < 0){
+      kfree(stack);
+      release(&t->lock);
+      return 0;
+    }
+    t->kstack = va;
+  }
+  t->tid = alloctid();
+  t->state = USED;
+  t->killed = 0;
+  t->cpu = -1;
+  t->runtime = t->waittime = 0;
+  t->nvcsw = t->nivcsw = 0;
+  t->vruntime = 0;
+  t->vcpu = -1;
+  t->trapframe = &p->trapframes[t - p->threads];
+
+  // Set up new context to start executing at forkret,
+  // which returns to user space.
+  memset(&t->context, 0, sizeof(t->context));
+  t->context.ra = (uint64)forkret;
+  t->context.sp = t->kstack + PGSIZE;
+  release(&t->lock);
+
+  return t;
+}
+
+// free a thread slot. t->lock and its process's lock
+// must be held, and t must not be running or on any queue.
+// its scheduler counters are added to the process's.
+static void
+freethread(struct kthread *t)
+{
+  struct proc *p = t->proc;
+
+  p->runtime += t->runtime;
+  p->waittime += t->waittime;
+  p->nvcsw += t->nvcsw;
+  p->nivcsw += t->nivcsw;
+  t->runtime = t->waittime = 0;
+  t->nvcsw = t->nivcsw = 0;
+  t->trapframe = 0;
+  t->tid = 0;
+  t->chan = 0;
+  t->killed = 0;
+  t->xstate = 0;
+  t->state = UNUSED;
 }
 
-// Look in the process table for an UNUSED proc.
+// Add an UNUSED proc to the process table, and return it
+// with p->lock held, or 0 if the table is full or memory
+// ran out.
+static struct proc*
+newproc(void)
+{
+  struct proc *p;
+  struct kthread *t;
+
+  if(sizeof(struct proc) > PGSIZE || NTHREAD * sizeof(struct kthread) > PGSIZE)
+    panic("newproc");
+  acquire(&proctab_lock);
+  if(nproc == NPROC || (p = kalloc_zeroed()) == 0){
+    release(&proctab_lock);
+    return 0;
+  }
+  if((p->threads = kalloc_zeroed()) == 0){
+    kfree(p);
+    release(&proctab_lock);
+    return 0;
+  }
+  initlock(&p->lock, "proc");
+  p->slot = nproc;
+  p->ofile = p->ofile0;
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++) {
+    initlock(&t->lock, "thread");
+    t->proc = p;
+  }
+  acquire(&p->lock);
+  proc[nproc] = p;
+  __atomic_store_n(&nproc, nproc + 1, __ATOMIC_RELEASE);
+  release(&proctab_lock);
+  return p;
+}
+
+// Look in the process table for an UNUSED proc, or add one.
 // If found, initialize state required to run in the kernel,
+// give it a first thread, p->threads[0], in state USED,
 // and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
+  int i, n;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  n = __atomic_load_n(&nproc, __ATOMIC_ACQUIRE);
+  for(i = 0; i < n; i++) {
+    p = proc[i];
     acquire(&p->lock);
     if(p->state == UNUSED) {
       goto found;
@@ -117,11 +399,15 @@ allocproc(void)
       release(&p->lock);
     }
   }
-  return 0;
+  if((p = newproc()) == 0)
+    return 0;
 
 found:
-  p->pid = allocpid();
+  // before kill() can find the new pid.
+  p->pending_signals = 0;
+  allocpid(p);
   p->state = USED;
+  tlbstale(p);  // entries under this slot's ASID are the last process's
 
   // Initialize handlers to be default
   
@@ -130,16 +416,30 @@ found:
   }
 
   p->signals_mask = 0;
-  p->pending_signals = 0;
   p->stopped = 0;
   p->signal_handling = 0;
+  p->sigframe = 0;
+  p->runtime = p->waittime = 0;
+  p->nvcsw = p->nivcsw = 0;
+  p->nice = 0;
+  p->quantum = 1;
+  memset(p->ncall, 0, sizeof(p->ncall));
+  memset(p->calltime, 0, sizeof(p->calltime));
+
+  // Allocate the trapframe page.
+  if((p->trapframes = (struct trapframe *)kalloc()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  // and the page user code reads its pid from.
+  if((p->vproc = (struct vproc *)kalloc_zeroed()) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
   }
+  p->vproc->pid = p->pid;
 
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
@@ -149,33 +449,45 @@ found:
     return 0;
   }
 
-  // Set up new context to start executing at forkret,
-  // which returns to user space.
-  memset(&p->context, 0, sizeof(p->context));
-  p->context.ra = (uint64)forkret;
-  p->context.sp = p->kstack + PGSIZE;
+  if(allocthread(p) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
 
   return p;
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages and all its threads.
+// p->lock must be held, and no thread may be running.
 static void
 freeproc(struct proc *p)
 {
-  if(p->trapframe)
-    kfree((void*)p->trapframe);
-  p->trapframe = 0;
+  struct kthread *t;
+
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++) {
+    acquire(&t->lock);
+    freethread(t);
+    release(&t->lock);
+  }
+  if(p->trapframes)
+    kfree((void*)p->trapframes);
+  p->trapframes = 0;
+  if(p->vproc)
+    kfree((void*)p->vproc);
+  p->vproc = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  if(p->pid)
+    freepid(p);
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
-  p->chan = 0;
   p->killed = 0;
+  p->exiting = 0;
   p->xstate = 0;
   p->state = UNUSED;
 }
@@ -202,9 +514,31 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe just below TRAMPOLINE, for trampoline.S.
+  // map the trapframes just below TRAMPOLINE, for trampoline.S.
   if(mappages(pagetable, TRAPFRAME, PGSIZE,
-              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+              (uint64)(p->trapframes), PTE_R | PTE_W) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
+  // the pages user code reads without a system call;
+  // see vdso.h.
+  if(mappages(pagetable, USHARED, PGSIZE, vdsopage(), PTE_R | PTE_U) < 0 ||
+     mappages(pagetable, UPROC, PGSIZE, (uint64)(p->vproc), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, USHARED, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
+  // where user signal handlers return to; see sigret().
+  if(mappages(pagetable, SIGTRAMP, PGSIZE,
+              (uint64)sigtramp, PTE_R | PTE_X | PTE_U) < 0){
+    uvmunmap(pagetable, UPROC, 1, 0);
+    uvmunmap(pagetable, USHARED, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
@@ -220,6 +554,9 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USHARED, 1, 0);
+  uvmunmap(pagetable, UPROC, 1, 0);
+  uvmunmap(pagetable, SIGTRAMP, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -240,9 +577,11 @@ void
 userinit(void)
 {
   struct proc *p;
+  struct kthread *t;
 
   p = allocproc();
   initproc = p;
+  t = &p->threads[0];
   
   // allocate one user page and copy init's instructions
   // and data into it.
@@ -250,13 +589,50 @@ userinit(void)
   p->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
-  p->trapframe->epc = 0;      // user program counter
-  p->trapframe->sp = PGSIZE;  // user stack pointer
+  t->trapframe->epc = 0;      // user program counter
+  t->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  acquire(&t->lock);
+  setrunnable(t);
+  release(&t->lock);
+
+  release(&p->lock);
+}
+
+// A kernel process starts here, still holding t->lock
+// from the scheduler, and runs the function that kproc()
+// left in its trapframe's epc.
+static void
+kprocret(void)
+{
+  struct kthread *t = mythread();
+
+  release(&t->lock);
+  ((void (*)(void))t->trapframe->epc)();
+  panic("kproc returned");
+}
+
+// Start a process that runs fn() in the kernel, with no
+// user memory, and never returns to user space.
+void
+kproc(void (*fn)(void), char *name)
+{
+  struct proc *p;
+  struct kthread *t;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  t = &p->threads[0];
+  t->trapframe->epc = (uint64)fn;
+  t->context.ra = (uint64)kprocret;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&t->lock);
+  setrunnable(t);
+  release(&t->lock);
 
   release(&p->lock);
 }
@@ -266,37 +642,83 @@ userinit(void)
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    // only reserve the address space; usertrap() allocates
+    // pages when they are first touched.
+    if(sz + n >= mmaplow(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    tlbstale(p);
   }
   p->sz = sz;
   return 0;
 }
 
+// Does p have live threads besides the current one?
+int
+otherthreads(struct proc *p)
+{
+  struct kthread *t;
+  int others = 0;
+
+  acquire(&p->lock);
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++){
+    if(t != mythread() && t->state != UNUSED && t->state != ZOMBIE)
+      others = 1;
+  }
+  release(&p->lock);
+  return others;
+}
+
 // Create a new process, copying the parent.
+// Only the calling thread is copied.
 // Sets up child kernel stack to return as if from fork() system call.
 int
 fork(void)
 {
-  int i, pid;
+  int i, pid, eager;
   struct proc *np;
+  struct kthread *nt;
   struct proc *p = myproc();
 
+  // mmap(MAP_SHARED) pages must exist to be shared.
+  if(mmapshare(p) < 0)
+    return -1;
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
+  nt = &np->threads[0];
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // increment reference counts on open file descriptors.
+  if(fdcopy(np, p) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  // Copy user memory from parent to child. This makes the
+  // parent's writable pages read-only, unless other threads
+  // of p may be running; nothing makes their cpus drop
+  // writable TLB entries, so then the pages are copied.
+  eager = otherthreads(p);
+  i = uvmcopy(p->pagetable, np->pagetable, p->sz, eager);
+  if(i == 0 && (i = mmapfork(p, np, eager)) < 0)
+    uvmunmap(np->pagetable, 0, PGROUNDUP(p->sz)/PGSIZE, 1);
+  tlbstale(p);
+  if(i < 0){
+    // np is USED, so nothing else takes it while
+    // the closes sleep without np->lock.
+    release(&np->lock);
+    fdcloseall(np);
+    acquire(&np->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
@@ -312,19 +734,21 @@ fork(void)
   }
 
   np->signals_mask = p->signals_mask;
-  np->pending_signals = 0;
+  np->nice = p->nice;
+  np->quantum = p->quantum;
 
   // copy saved user registers.
-  *(np->trapframe) = *(p->trapframe);
+  *(nt->trapframe) = *(mythread()->trapframe);
 
   // Cause fork to return 0 in the child.
-  np->trapframe->a0 = 0;
+  nt->trapframe->a0 = 0;
+  nt->trapframe->tp = nt->tid;
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
+  memmove(np->segs, p->segs, sizeof(p->segs));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -333,16 +757,169 @@ fork(void)
   release(&np->lock);
 
   acquire(&wait_lock);
-  np->parent = p;
+  addchild(p, np);
   release(&wait_lock);
 
-  acquire(&np->lock);
-  np->state = RUNNABLE;
-  release(&np->lock);
+  acquire(&nt->lock);
+  setrunnable(nt);
+  release(&nt->lock);
 
   return pid;
 }
 
+// Start a new thread in the current process, running
+// fn(arg) on the user stack whose top is stack.
+// fn must finish with thread_exit(); it has nowhere
+// to return to. Returns the new thread's tid.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  struct proc *p = myproc();
+  struct kthread *nt;
+  int tid;
+
+  acquire(&p->lock);
+  if(p->exiting || (nt = allocthread(p)) == 0){
+    release(&p->lock);
+    return -1;
+  }
+
+  *(nt->trapframe) = *(mythread()->trapframe);
+  nt->trapframe->epc = fn;
+  nt->trapframe->sp = stack & ~0xfL;
+  nt->trapframe->a0 = arg;
+  nt->trapframe->tp = nt->tid;
+  tid = nt->tid;
+
+  acquire(&nt->lock);
+  setrunnable(nt);
+  release(&nt->lock);
+  release(&p->lock);
+
+  return tid;
+}
+
+// Wait for thread tid of the current process to exit,
+// and copy its exit status to addr if it isn't 0.
+// Returns -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct kthread *t;
+
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++){
+    if(t->tid == tid && t != mythread())
+      break;
+  }
+  if(t == &p->threads[NTHREAD])
+    return -1;
+
+  // the status is copied out with p->lock held.
+  if(addr != 0)
+    uvmprefault(p->pagetable, addr, sizeof(t->xstate), 1);
+  acquire(&p->lock);
+  for(;;){
+    // the slot may have been joined and reused meanwhile.
+    if(t->tid != tid || killed()){
+      release(&p->lock);
+      return -1;
+    }
+    if(t->state == ZOMBIE)
+      break;
+    sleep(t, &p->lock);
+  }
+
+  if(addr != 0 && copyout(p->pagetable, addr, (char *)&t->xstate,
+                          sizeof(t->xstate)) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  // make sure t has switched away for the last time.
+  acquire(&t->lock);
+  freethread(t);
+  release(&t->lock);
+  release(&p->lock);
+  return 0;
+}
+
+// Exit the current thread, leaving the rest of the
+// process running. Does not return. The thread
+// remains a ZOMBIE until another thread join()s it.
+static void
+kthread_exit(int status)
+{
+  struct proc *p = myproc();
+  struct kthread *t = mythread();
+
+  acquire(&p->lock);
+  t->xstate = status;
+
+  // a joiner or killothers() might be waiting.
+  wakeup(t);
+
+  acquire(&t->lock);
+  t->state = ZOMBIE;
+  release(&p->lock);
+
+  // Jump into the scheduler, never to return.
+  sched();
+  panic("zombie thread exit");
+}
+
+// Exit the current thread. If it is the last one,
+// the whole process exits with status.
+void
+thread_exit(int status)
+{
+  if(otherthreads(myproc()))
+    kthread_exit(status);
+  exit(status);
+}
+
+// Kill the other threads of the current process, wait
+// for them to exit, and free them, so that the caller can
+// tear down or replace the address space all threads share.
+// Returns -1 without waiting if another thread is already
+// doing this; the caller should then leave with exit().
+int
+killothers(void)
+{
+  struct proc *p = myproc();
+  struct kthread *t;
+
+  acquire(&p->lock);
+  if(p->exiting){
+    release(&p->lock);
+    return -1;
+  }
+  p->exiting = 1;
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++){
+    if(t != mythread() && t->state != UNUSED)
+      t->killed = 1;
+  }
+  release(&p->lock);
+
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++){
+    if(t != mythread())
+      wakethread(t);
+  }
+
+  acquire(&p->lock);
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++){
+    if(t == mythread())
+      continue;
+    while(t->state != UNUSED && t->state != ZOMBIE)
+      sleep(t, &p->lock);
+    acquire(&t->lock);
+    freethread(t);
+    release(&t->lock);
+  }
+  p->exiting = 0;
+  release(&p->lock);
+  return 0;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -350,38 +927,48 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  while((pp = p->children) != 0){
+    delchild(pp);
+    addchild(initproc, pp);
   }
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait().
+// If another thread of the process is already exiting,
+// only the calling thread exits.
 void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct kthread *t = mythread();
 
   if(p == initproc)
     panic("init exiting");
 
+  if(killothers() < 0)
+    kthread_exit(status);
+
+  // Write back and drop mmap() regions, which may
+  // refer to files that are about to be closed.
+  mmapclear(p);
+  uring_free(p);
+
   // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  fdcloseall(p);
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
+  p->nseg = 0;
 
   acquire(&wait_lock);
 
@@ -398,6 +985,10 @@ exit(int status)
 
   release(&wait_lock);
 
+  acquire(&t->lock);
+  t->state = ZOMBIE;
+  release(&p->lock);
+
   // Jump into the scheduler, never to return.
   sched();
   panic("zombie exit");
@@ -412,37 +1003,41 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the status is copied out with locks held.
+  if(addr != 0)
+    uvmprefault(p->pagetable, addr, sizeof(int), 1);
   acquire(&wait_lock);
 
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&np->lock);
-
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(np);
+    for(np = p->children; np; np = np->sibling){
+      // make sure the child isn't still in exit().
+      acquire(&np->lock);
+
+      havekids = 1;
+      if(np->state == ZOMBIE){
+        // Found one.
+        pid = np->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                sizeof(np->xstate)) < 0) {
           release(&np->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        delchild(np);
+        // freeproc() takes each thread's lock, so it
+        // waits for the last one to leave swtch().
+        freeproc(np);
         release(&np->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || p->killed){
+    if(!havekids || killed()){
       release(&wait_lock);
       return -1;
     }
@@ -452,90 +1047,337 @@ wait(uint64 addr)
   }
 }
 
-// Per-CPU process scheduler.
+// The vruntime that d time CSR ticks of running is worth
+// to thread t.
+static uint64
+vscale(struct kthread *t, uint64 d)
+{
+  return d * NICE0_WEIGHT / niceweight[t->proc->nice - NICE_MIN];
+}
+
+// Add t to cpu c's heap. Caller holds c->rqlock.
+static void
+rq_push(struct cpu *c, struct kthread *t)
+{
+  int i, up;
+
+  for(i = c->nrunnable++; i > 0; i = up){
+    up = (i - 1) / 2;
+    if(c->rq[up]->vruntime <= t->vruntime)
+      break;
+    c->rq[i] = c->rq[up];
+  }
+  c->rq[i] = t;
+}
+
+// Remove and return the thread with the least vruntime
+// from cpu c's heap, which is not empty. Caller holds
+// c->rqlock.
+static struct kthread*
+rq_pop(struct cpu *c)
+{
+  struct kthread *t, *last;
+  int i, down, n;
+
+  t = c->rq[0];
+  n = --c->nrunnable;
+  last = c->rq[n];
+  for(i = 0; (down = 2*i + 1) < n; i = down){
+    if(down + 1 < n && c->rq[down+1]->vruntime < c->rq[down]->vruntime)
+      down++;
+    if(last->vruntime <= c->rq[down]->vruntime)
+      break;
+    c->rq[i] = c->rq[down];
+  }
+  c->rq[i] = last;
+  return t;
+}
+
+// Make t's vruntime relative to cpu c's minvruntime,
+// keeping how far ahead or behind it was on the cpu it
+// came from, but no more than SCHED_LATENCY behind.
+// A new thread starts level with c's.
+// Caller must hold t->lock.
+static void
+vplace(struct cpu *c, struct kthread *t)
+{
+  long lag;
+
+  lag = 0;
+  if(t->vcpu >= 0)
+    lag = t->vruntime - cpus[t->vcpu].minvruntime;
+  if(lag < -SCHED_LATENCY)
+    lag = -SCHED_LATENCY;
+  t->vruntime = c->minvruntime + lag;
+  t->vcpu = c - cpus;
+}
+
+// Put t on cpu c's run queue.
+// Caller must hold t->lock, and t must be RUNNABLE
+// and not already on a run queue. If c has gone
+// idle with its clock muted it would not notice t
+// for a while, so t goes on this cpu's queue instead.
+static void
+runqueue_put(struct cpu *c, struct kthread *t)
+{
+  acquire(&c->rqlock);
+  if(c->idle){
+    release(&c->rqlock);
+    c = mycpu();
+    acquire(&c->rqlock);
+  }
+  vplace(c, t);
+  rq_push(c, t);
+  release(&c->rqlock);
+}
+
+// Remove and return the thread with the least vruntime
+// on cpu c's run queue, or 0 if the queue is empty.
+// Only c itself calls this.
+// The caller must then acquire t->lock; t stays
+// RUNNABLE until whoever dequeued it runs it.
+static struct kthread*
+runqueue_get(struct cpu *c)
+{
+  struct kthread *t;
+
+  acquire(&c->rqlock);
+  t = 0;
+  if(c->nrunnable > 0){
+    t = rq_pop(c);
+    if(t->vruntime > c->minvruntime)
+      c->minvruntime = t->vruntime;
+  }
+  release(&c->rqlock);
+  return t;
+}
+
+// Take a thread from another cpu's run queue for
+// the idle cpu c. Prefers the longest queue. The
+// victim's next thread is only taken if the victim has
+// more work queued behind it, or if it hasn't run for
+// MIGRATE_TICKS, so that cache-warm threads stay put.
+// Returns 0 if there is nothing worth stealing.
+// scheduler() moves the thread's vruntime over to c.
+static struct kthread*
+runqueue_steal(struct cpu *c)
+{
+  struct cpu *v, *victim;
+  struct kthread *t;
+
+  // pick a victim without locks; recheck below.
+  victim = 0;
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v == c || !v->online || v->nrunnable == 0)
+      continue;
+    if(victim == 0 || v->nrunnable > victim->nrunnable)
+      victim = v;
+  }
+  if(victim == 0)
+    return 0;
+
+  acquire(&victim->rqlock);
+  t = 0;
+  if(victim->nrunnable > 0 &&
+     (victim->nrunnable > 1 || ticks - victim->rq[0]->lastrun >= MIGRATE_TICKS))
+    t = rq_pop(victim);
+  release(&victim->rqlock);
+  return t;
+}
+
+// Choose the run queue for t: the cpu it last ran
+// on if it has one, otherwise the least loaded cpu
+// (so the children of a fork-heavy job spread out).
+// Interrupts must be disabled.
+static struct cpu*
+runqueue_pick(struct kthread *t)
+{
+  struct cpu *c, *best;
+
+  if(t->cpu >= 0 && cpus[t->cpu].online && !cpus[t->cpu].idle)
+    return &cpus[t->cpu];
+
+  best = mycpu();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->online && !c->idle && c->nrunnable < best->nrunnable)
+      best = c;
+  }
+  return best;
+}
+
+// Mark t RUNNABLE and queue it on a cpu.
+// Every transition to RUNNABLE must go through
+// here so that the scheduler can find t.
+// Caller must hold t->lock.
+static void
+setrunnable(struct kthread *t)
+{
+  if(!holding(&t->lock))
+    panic("setrunnable");
+  // a running thread's wait starts in sched().
+  if(t->state != RUNNING)
+    t->stamp = r_time();
+  t->state = RUNNABLE;
+  runqueue_put(runqueue_pick(t), t);
+}
+
+// Per-CPU thread scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
-//  - swtch to start running that process.
-//  - eventually that process transfers control
+//  - take the thread with the least vruntime off this cpu's
+//    run queue, or steal one from a busier cpu if it is empty.
+//  - swtch to start running that thread.
+//  - eventually that thread transfers control
 //    via swtch back to the scheduler.
 void
 scheduler(void)
 {
-  struct proc *p;
+  struct kthread *t;
+  uint64 now;
   struct cpu *c = mycpu();
   
-  c->proc = 0;
+  c->thread = 0;
+  c->online = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((t = runqueue_get(c)) == 0 && (t = runqueue_steal(c)) == 0){
+      // spare time: zero a page for kalloc_zeroed(),
+      // then look at the run queue again.
+      if(kzero_fill())
+        continue;
+
+      // nothing to do: wait for an interrupt without
+      // taking clock ticks. interrupts stay off from the
+      // check until the wfi so a wakeup can't slip in
+      // between; runqueue_put() won't queue on an idle cpu.
+      intr_off();
+      acquire(&c->rqlock);
+      c->idle = (c->nrunnable == 0);
+      release(&c->rqlock);
+      if(c->idle)
+        timer_idle();
+      c->idle = 0;
+      continue;
     }
+
+    acquire(&t->lock);
+    if(t->state == RUNNABLE) {
+      // Switch to chosen thread.  It is the thread's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      t->state = RUNNING;
+      t->cpu = c - cpus;
+      t->lastrun = ticks;
+      if(t->vcpu != t->cpu)
+        vplace(c, t);   // stolen
+      t->slice = t->proc->quantum;
+      now = r_time();
+      t->waittime += now - t->stamp;
+      t->stamp = now;
+      c->thread = t;
+      swtch(&c->context, &t->context);
+
+      // Thread is done running for now.
+      // It should have changed its t->state before coming back.
+      c->thread = 0;
+    }
+    release(&t->lock);
   }
 }
 
-// Switch to scheduler.  Must hold only p->lock
-// and have changed proc->state. Saves and restores
+// Switch to scheduler.  Must hold only t->lock
+// and have changed t->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
-// be proc->intena and proc->noff, but that would
+// be t->intena and t->noff, but that would
 // break in the few places where a lock is held but
-// there's no process.
+// there's no thread.
 void
 sched(void)
 {
   int intena;
-  struct proc *p = myproc();
+  uint64 now;
+  struct kthread *t = mythread();
 
-  if(!holding(&p->lock))
-    panic("sched p->lock");
+  if(!holding(&t->lock))
+    panic("sched t->lock");
   if(mycpu()->noff != 1)
     panic("sched locks");
-  if(p->state == RUNNING)
+  if(t->state == RUNNING)
     panic("sched running");
   if(intr_get())
     panic("sched interruptible");
 
+  // a thread that is still RUNNABLE came from yield().
+  now = r_time();
+  t->runtime += now - t->stamp;
+  t->vruntime += vscale(t, now - t->stamp);
+  t->stamp = now;
+  if(t->state == RUNNABLE)
+    t->nivcsw++;
+  else
+    t->nvcsw++;
+
   intena = mycpu()->intena;
-  swtch(&p->context, &mycpu()->context);
+  swtch(&t->context, &mycpu()->context);
   mycpu()->intena = intena;
 }
 
+// Called on each clock interrupt that finds a thread
+// running. Returns 1 if the thread should yield(): another
+// thread is waiting for this cpu and either the running
+// thread's quantum is used up, or the waiting one is more
+// than SCHED_WAKEUP_GRAN behind it in vruntime.
+int
+sched_tick(void)
+{
+  struct kthread *t = mythread();
+  struct cpu *c;
+  uint64 v;
+  int yes;
+
+  push_off();
+  c = mycpu();
+  t->slice--;
+  acquire(&c->rqlock);
+  if(c->nrunnable == 0){
+    yes = 0;
+  } else if(t->slice <= 0){
+    yes = 1;
+  } else {
+    v = t->vruntime + vscale(t, r_time() - t->stamp);
+    yes = c->rq[0]->vruntime + SCHED_WAKEUP_GRAN < v;
+  }
+  release(&c->rqlock);
+  // with nobody waiting, start a new quantum.
+  if(t->slice <= 0 && !yes)
+    t->slice = t->proc->quantum;
+  pop_off();
+  return yes;
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
 {
-  struct proc *p = myproc();
-  acquire(&p->lock);
-  p->state = RUNNABLE;
+  struct kthread *t = mythread();
+  acquire(&t->lock);
+  setrunnable(t);
   sched();
-  release(&p->lock);
+  release(&t->lock);
 }
 
-// A fork child's very first scheduling by scheduler()
+// A new thread's very first scheduling by scheduler()
 // will swtch to forkret.
 void
 forkret(void)
 {
   static int first = 1;
 
-  // Still holding p->lock from scheduler.
-  release(&myproc()->lock);
+  // Still holding t->lock from scheduler.
+  release(&mythread()->lock);
 
   if (first) {
     // File system initialization must be run in the context of a
@@ -553,48 +1395,115 @@ forkret(void)
 void
 sleep(void *chan, struct spinlock *lk)
 {
-  struct proc *p = myproc();
+  struct kthread *t = mythread();
+  struct waitq *wq = chanq(chan);
   
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Must acquire t->lock in order to
+  // change t->state and then call sched.
+  // Once we hold chan's wait queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the queue),
   // so it's okay to release lk.
 
-  acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&wq->lock);
+  acquire(&t->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
-  p->chan = chan;
-  p->state = SLEEPING;
+  t->chan = chan;
+  t->state = SLEEPING;
+  t->wqnext = wq->head;
+  wq->head = t;
+  release(&wq->lock);
 
   sched();
 
   // Tidy up.
-  p->chan = 0;
+  t->chan = 0;
 
   // Reacquire original lock.
-  release(&p->lock);
+  release(&t->lock);
   acquire(lk);
 }
 
-// Wake up all processes sleeping on chan.
-// Must be called without any p->lock.
+// Wake up all threads sleeping on chan.
+// Must be called without any t->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct kthread *t, **pp;
+  struct waitq *wq = chanq(chan);
+
+  acquire(&wq->lock);
+  pp = &wq->head;
+  while((t = *pp) != 0){
+    // t->chan can't change while t is on the queue.
+    if(t->chan != chan){
+      pp = &t->wqnext;
+      continue;
+    }
+    *pp = t->wqnext;
+    t->wqnext = 0;
+    acquire(&t->lock);
+    if(t->state == SLEEPING)
+      setrunnable(t);
+    release(&t->lock);
+  }
+  release(&wq->lock);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+// Make t RUNNABLE if it is sleeping or stopped, so
+// that it notices it has been killed.
+// Must be called without any t->lock.
+static void
+wakethread(struct kthread *t)
+{
+  struct kthread **pp;
+  struct waitq *wq;
+  void *chan;
+
+  acquire(&t->lock);
+  if(t->state == STOPPED)
+    setrunnable(t);
+  chan = t->state == SLEEPING ? t->chan : 0;
+  release(&t->lock);
+  if(chan == 0)
+    return;
+
+  // t may be woken and even sleep somewhere else
+  // before we get the queue lock; then it isn't on
+  // this queue and will see t->killed by itself.
+  wq = chanq(chan);
+  acquire(&wq->lock);
+  for(pp = &wq->head; *pp; pp = &(*pp)->wqnext){
+    if(*pp == t){
+      *pp = t->wqnext;
+      t->wqnext = 0;
+      acquire(&t->lock);
+      if(t->state == SLEEPING)
+        setrunnable(t);
+      release(&t->lock);
+      break;
     }
   }
+  release(&wq->lock);
+}
+
+// Return the live process with the given pid, or 0. It may
+// exit at any moment, so the caller may only read fields
+// that don't matter much if stale, like statistics.
+struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext){
+    if(p->pid == pid)
+      break;
+  }
+  release(&pid_lock);
+  return p;
 }
 
 // Kill the process with the given pid.
@@ -604,35 +1513,46 @@ int
 kill(int pid, int signum)
 {
   struct proc *p;
+  struct kthread *t;
   uint op = 1 << signum;
+  uint pending_sigs;
 
   if(signum < 0 || signum > 31)
     return -1;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      //debug
-      printf("%d: got %d\n",p->pid,signum);
-        //printf("inside kill ! i: %d, process pid: %d, signal_handler[i]: %d\n",i, p->pid, p->signal_handlers[i]);
-
-      if(p->killed || p->state==ZOMBIE || p->state==UNUSED){
-        return -1;
-      }
-      //TO ADD - after implemenation of CAS
-      /*
-      do{
-        pending_sigs = p->pending_signals;
-      }
-      while(!cas(&p->pending_signals, pending_sigs, pending_sigs|op));
-      */
-      p->pending_signals = p->pending_signals|op;
-      release(&p->lock);
-      return 0;
+  // no p->lock: the signal bit is posted with cas(), so
+  // senders don't serialize on the target. pid_lock keeps
+  // p in pidhash[], and so its slot from being reused,
+  // until the bit is posted.
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext){
+    if(p->pid == pid)
+      break;
+  }
+  if(p == 0 || p->killed || p->state==ZOMBIE || p->state==UNUSED){
+    release(&pid_lock);
+    return -1;
+  }
+  do{
+    pending_sigs = p->pending_signals;
+  }
+  while(!cas(&p->pending_signals, pending_sigs, pending_sigs|op));
+  release(&pid_lock);
+  // if p has gone since, there is nothing to wake.
+  if(p->pid != pid)
+    return 0;
+  // a stopped process needs waking to notice a
+  // signal that could continue it.
+  if(signum == SIGCONT || signum == SIGKILL ||
+     p->signal_handlers[signum] == (void*)SIGCONT){
+    for(t = p->threads; t < &p->threads[NTHREAD]; t++){
+      acquire(&t->lock);
+      if(t->state == STOPPED)
+        setrunnable(t);
+      release(&t->lock);
     }
-    release(&p->lock);
   }
-  return -1;
+  return 0;
 }
 
 uint
@@ -647,8 +1567,6 @@ sigprocmask(uint mask)
 int
 sigaction(int signum, const struct sigaction *act, struct sigaction *oldact)
 {
-  //debug
-  printf("act: %d\n", act);
   struct proc *p = myproc();
 
   if(signum < 0 || signum > 31)
@@ -663,19 +1581,13 @@ sigaction(int signum, const struct sigaction *act, struct sigaction *oldact)
   //struct sigaction *var;
 
   if(act == (void*)SIG_DFL) {
-    //debug
-    printf("inside SIG_DFL case\n");
     if( oldact != 0)
       memmove(&oldact, &p->signal_handlers[signum], sizeof(void*));
       //copyout(p->pagetable, (uint64)&oldact, (char*)&p->signal_handlers[signum], sizeof(struct sigaction));
     p->signal_handlers[signum] = &act;
   }
   else {
-    //debug
-    printf("user handler case\n");
     if (oldact != 0) {
-      //debut
-      printf("memmove to oldact\n");
       memmove(&oldact, &p->signal_handlers[signum], sizeof(void*));
     }
     //copyout(p->pagetable, (uint64)&oldact, (char*)&p->signal_handlers[signum], sizeof(struct sigaction));
@@ -691,22 +1603,45 @@ sigaction(int signum, const struct sigaction *act, struct sigaction *oldact)
   return 0;
 }
 
-void
+// Return from a user signal handler, through SIGTRAMP:
+// restore what usersignalhandler() saved. Returns the
+// interrupted a0, so that syscall() puts it back.
+uint64
 sigret(void)
 {
-  //debug
-  printf("sigret!!!\n");
-  printf("inside sigret!!!!!!\n");
   struct proc *p = myproc();
+  struct trapframe *tf = mythread()->trapframe;
+  struct sigframe fr;
+
+  // copyin() can't read an unloaded page in under p->lock.
+  if(p->sigframe)
+    uvmprefault(p->pagetable, p->sigframe, sizeof(fr), 0);
   acquire(&p->lock);
-  copyin(p->pagetable, (char*)p->trapframe, (uint64)p->user_tf_backup, sizeof(struct trapframe));
+  if(p->sigframe == 0 ||
+     copyin(p->pagetable, (char*)&fr, p->sigframe, sizeof(fr)) < 0){
+    // no handler to return from, or its frame is gone.
+    p->killed = 1;
+    release(&p->lock);
+    return -1;
+  }
+  tf->epc = fr.epc;
+  tf->ra = fr.ra;
+  tf->sp = fr.sp;
+  tf->gp = fr.gp;
+  tf->tp = fr.tp;
+  tf->t0 = fr.t[0];
+  tf->t1 = fr.t[1];
+  tf->t2 = fr.t[2];
+  tf->t3 = fr.t[3];
+  tf->t4 = fr.t[4];
+  tf->t5 = fr.t[5];
+  tf->t6 = fr.t[6];
+  memmove(&tf->a1, &fr.a[1], 7 * sizeof(uint64));
   p->signals_mask = p->signals_mask_backup;
-  p->user_tf_backup = 0;
+  p->sigframe = 0;
   p->signal_handling = 0;
   release(&p->lock);
-  //debug
-  printf("end of sigret func\n");
-  //return p->trapframe->eax; // ?????
+  return fr.a[0];
 }
 
 // Copy to either a user address, or kernel address,
@@ -739,33 +1674,198 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
   }
 }
 
+static char *states[] = {
+[UNUSED]    "unused",
+[USED]      "used  ",
+[SLEEPING]  "sleep ",
+[RUNNABLE]  "runble",
+[RUNNING]   "run   ",
+[STOPPED]   "stop  ",
+[ZOMBIE]    "zombie"
+};
+
+static char*
+statename(enum procstate s)
+{
+  if(s >= 0 && s < NELEM(states) && states[s])
+    return states[s];
+  return "???";
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
+// Times are in clock ticks.
 void
 procdump(void)
 {
-  static char *states[] = {
-  [UNUSED]    "unused",
-  [SLEEPING]  "sleep ",
-  [RUNNABLE]  "runble",
-  [RUNNING]   "run   ",
-  [ZOMBIE]    "zombie"
-  };
   struct proc *p;
-  char *state;
+  struct kthread *t;
+  int i;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(i = 0; i < nproc; i++){
+    p = proc[i];
+    if(p->state == UNUSED)
+      continue;
+    for(t = p->threads; t < &p->threads[NTHREAD]; t++){
+      if(t->state == UNUSED)
+        continue;
+      printf("%d.%d %s %s", p->pid, t->tid, statename(t->state), p->name);
+      printf(" cpu %d run %d wait %d csw %d/%d", t->cpu,
+             (int)(t->runtime / TIMER_INTERVAL), (int)(t->waittime / TIMER_INTERVAL),
+             (int)t->nvcsw, (int)t->nivcsw);
+      printf("\n");
+    }
+  }
+}
+
+// Set the nice level of process pid, or of the caller if
+// pid is 0, clamped to NICE_MIN..NICE_MAX. Returns 0, or
+// -1 if there is no such process. getprocinfo() reports
+// the current level.
+int
+setnice(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < NICE_MIN)
+    nice = NICE_MIN;
+  if(nice > NICE_MAX)
+    nice = NICE_MAX;
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return -1;
+  }
+  p->nice = nice;
+  release(&p->lock);
+  return 0;
+}
+
+// Set the quantum, in clock ticks, of process pid, or of
+// the caller if pid is 0, clamped to 1..MAXQUANTUM. Returns
+// 0, or -1 if there is no such process. A running thread
+// picks the new quantum up the next time it is switched in.
+int
+setquantum(int pid, int quantum)
+{
+  struct proc *p;
+
+  if(quantum < 1)
+    quantum = 1;
+  if(quantum > MAXQUANTUM)
+    quantum = MAXQUANTUM;
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return -1;
+  }
+  p->quantum = quantum;
+  release(&p->lock);
+  return 0;
+}
+
+// How active a thread state is, for picking the state
+// getprocinfo() reports for a process.
+static int
+activity(enum procstate s)
+{
+  switch(s){
+  case RUNNING:  return 5;
+  case RUNNABLE: return 4;
+  case SLEEPING: return 3;
+  case STOPPED:  return 2;
+  case ZOMBIE:   return 1;
+  default:       return 0;
+  }
+}
+
+// Fill in *pi for p, which is in use.
+static void
+procinfo(struct proc *p, struct procinfo *pi)
+{
+  struct kthread *t;
+  enum procstate state;
+  uint64 now, last;
+
+  acquire(&wait_lock);
+  pi->ppid = p->parent ? p->parent->pid : 0;
+  release(&wait_lock);
+
+  acquire(&p->lock);
+  pi->pid = p->pid;
+  pi->nice = p->nice;
+  pi->quantum = p->quantum;
+  safestrcpy(pi->name, p->name, sizeof(pi->name));
+  pi->sz = p->sz;
+  pi->runtime = p->runtime;
+  pi->waittime = p->waittime;
+  pi->nvcsw = p->nvcsw;
+  pi->nivcsw = p->nivcsw;
+  pi->nthread = 0;
+  pi->cpu = -1;
+  state = p->state;
+  last = 0;
+  now = r_time();
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++){
+    acquire(&t->lock);
+    if(t->state != UNUSED){
+      pi->nthread++;
+      pi->runtime += t->runtime;
+      pi->waittime += t->waittime;
+      pi->nvcsw += t->nvcsw;
+      pi->nivcsw += t->nivcsw;
+      // count the time since the last switch, too.
+      if(t->state == RUNNING)
+        pi->runtime += now - t->stamp;
+      else if(t->state == RUNNABLE)
+        pi->waittime += now - t->stamp;
+      if(activity(t->state) > activity(state))
+        state = t->state;
+      if(t->cpu >= 0 && (pi->cpu < 0 || t->lastrun >= last)){
+        pi->cpu = t->cpu;
+        last = t->lastrun;
+      }
+    }
+    release(&t->lock);
+  }
+  release(&p->lock);
+  safestrcpy(pi->state, statename(state), sizeof(pi->state));
+}
+
+// Copy information about up to n processes to user
+// address addr, as an array of struct procinfo.
+// Returns the number copied.
+int
+getprocinfo(uint64 addr, int n)
+{
+  struct proc *p;
+  struct procinfo pi;
+  int i, j, m;
+
+  i = 0;
+  m = __atomic_load_n(&nproc, __ATOMIC_ACQUIRE);
+  for(j = 0; j < m && i < n; j++){
+    p = proc[j];
     if(p->state == UNUSED)
       continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
-    printf("\n");
+    procinfo(p, &pi);
+    if(pi.pid == 0)
+      continue;   // freed meanwhile
+    if(copyout(myproc()->pagetable, addr + i*sizeof(pi), (char*)&pi, sizeof(pi)) < 0)
+      return -1;
+    i++;
   }
+  return i;
 }
 
 void 
@@ -790,11 +1890,39 @@ void
 sigkill_func(void)
 {
   struct proc *p = myproc();
+  struct kthread *t;
+
   acquire(&p->lock);
   p->killed = 1;
-  if(p->state == SLEEPING)
-    p->state = RUNNABLE;
   release(&p->lock);
+
+  // the other threads must notice too.
+  for(t = p->threads; t < &p->threads[NTHREAD]; t++){
+    if(t != mythread())
+      wakethread(t);
+  }
+}
+
+// The signals p could take now: pending and not blocked.
+// SIGKILL and SIGSTOP can't be blocked.
+static uint
+deliverable_signals(struct proc *p)
+{
+  uint non_maskable = ~(1 << SIGKILL) & ~(1 << SIGSTOP);
+
+  return p->pending_signals & ~(p->signals_mask & non_maskable);
+}
+
+// Number of the lowest set bit in x, which must not be 0.
+static int
+ctz(uint x)
+{
+  static const char debruijn[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+  };
+
+  return debruijn[((x & -x) * 0x077CB531U) >> 27];
 }
 
 int
@@ -855,25 +1983,41 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, sizeof(struct trapframe)
 
 void
 turnoff_sigbit(struct proc *p, int i) {
-  
-  //int op = 1 << i;   UNCOMMENT LATER
-  //uint pending_sigs = p->pending_signals;   UNCOMMENT LATER
-  acquire(&p->lock);
-  p->pending_signals = p->pending_signals & ~(1 << i);
-  release(&p->lock);
-  //TO ADD - after implemenation of CAS
-  /*
-  while(!cas(&p->pending_signals, pending_sigs, pending_sigs&op)){
+  uint op = ~(1 << i);
+  uint pending_sigs;
+
+  do{
     pending_sigs = p->pending_signals;
   }
-  */
+  while(!cas(&p->pending_signals, pending_sigs, pending_sigs&op));
 }
     //p->pending_signals = p->pending_signals & ~(1 << i); 
 
 
+// Is a signal that would continue p deliverable?
+// Like search_cont_signals(), but only looks, so that
+// it can be called with t->lock held.
+static int
+cont_pending(struct proc *p)
+{
+  uint sigs = deliverable_signals(p);
+
+  if(sigs & ((1 << SIGCONT) | (1 << SIGKILL)))
+    return 1;
+  for(; sigs; sigs &= sigs - 1) {
+    if(p->signal_handlers[ctz(sigs)] == (void*)SIGCONT)
+      return 1;
+  }
+  return 0;
+}
+
 int
 search_cont_signals(void) {
   struct proc *p = myproc();
+  uint sigs = deliverable_signals(p);
+
+  if(sigs == 0)
+    return 0;
 
   if(is_pending_and_not_masked(SIGCONT)) {
     sigcont_func();
@@ -887,13 +2031,12 @@ search_cont_signals(void) {
     return 1;
   }
 
-  for(int i = 0; i < 32; i++) {
-    if(is_pending_and_not_masked(i)) {
-      if(p->signal_handlers[i] == (void*)SIGCONT){
-        sigcont_func();
-        turnoff_sigbit(p, i);
-        return 1;
-      }
+  for(; sigs; sigs &= sigs - 1) {
+    int i = ctz(sigs);
+    if(p->signal_handlers[i] == (void*)SIGCONT){
+      sigcont_func();
+      turnoff_sigbit(p, i);
+      return 1;
     }
   }
 
@@ -904,13 +2047,19 @@ void
 signalhandler(void)
 {
   struct proc *p = myproc();
+  struct kthread *t;
+  uint sigs;
   
   if(p == 0)
     return;
   
   if(p->signal_handling)
     return;
-  
+
+  // this runs on every return to user space, and usually
+  // there is nothing to do.
+  if(deliverable_signals(p) == 0 && !p->stopped)
+    return;
 
   //make sure its not a kernel trap???????
 
@@ -919,7 +2068,7 @@ signalhandler(void)
 
     //int signal_ptr= 1 << i;
     //check p->killed????
-    if(p->killed)
+    if(killed())
       return;
 
     while(p->stopped) {
@@ -927,11 +2076,27 @@ signalhandler(void)
       {
         break;
       }
-      //yield CPU back to the scheduler
-      yield();
+      // give up the cpu until kill() sends something that
+      // could continue us. checking under t->lock means
+      // kill() can't post it and miss the STOPPED state.
+      if(killed())
+        return;
+      t = mythread();
+      acquire(&t->lock);
+      if(!cont_pending(p)){
+        t->state = STOPPED;
+        sched();
+      }
+      release(&t->lock);
     }
 
     
+    // skip straight to the next deliverable signal.
+    sigs = deliverable_signals(p) & ~((1U << i) - 1);
+    if(sigs == 0)
+      break;
+    i = ctz(sigs);
+
     if(is_pending_and_not_masked(i))
     {
       // printf("process pid: %d, signal_handler[i]: %d\n", p->pid, p->signal_handlers[i]);
@@ -941,10 +2106,8 @@ signalhandler(void)
       if(p->signal_handling)
         return;
       //printf("handler: %d\n", p->signal_handlers[i]);
-      //debug
-      printf("handle signal: %d\n", i);
-
       if(p->signal_handlers[i] == (void*)SIG_IGN){
+        turnoff_sigbit(p, i);
         continue;
       }
       //kernel space handler
@@ -1001,83 +2164,56 @@ signalhandler(void)
 
 }
 
+// Run p's handler for signum when the current thread goes
+// back to user space: save the registers it may change in
+// a struct sigframe on the user stack, and make it return
+// to SIGTRAMP, which calls sigret().
 void
-usersignalhandler(struct proc *p, int signum) {
+usersignalhandler(struct proc *p, int signum)
+{
+  struct trapframe *tf = mythread()->trapframe;
+  struct sigaction *act;
+  struct sigframe fr;
+  uint64 handler, sp;
+  uint mask;
+
+  // fault in the frame's pages, and the sigaction, now:
+  // under p->lock copyout() can't read an unloaded page in,
+  // or take p->lock to look up an mmap() region.
+  act = (struct sigaction*)p->signal_handlers[signum];
+  sp = (tf->sp - sizeof(fr)) & ~0xfL;
+  uvmprefault(p->pagetable, sp, sizeof(fr), 1);
+  uvmprefault(p->pagetable, (uint64)act, sizeof(*act), 0);
+
   acquire(&p->lock);
-  //debug
-  printf("user handeling %d\n",signum);
-  //1
-    //debug
-  //printf("on stage 1\n");
-  uint64 dst; 
-  struct sigaction *handler = (struct sigaction*) p->signal_handlers[signum];
-  copyin(p->pagetable, (char*)&dst, (uint64)&handler->sa_handler, sizeof(void*));
-  
-  //2
-  //debug
-  //printf("on stage 2\n");
-  //backup mask
-  uint sigmask;
-  copyin(p->pagetable, (char*)&sigmask, (uint64)&handler->sigmask, sizeof(uint));
-  uint backup_mask = sigprocmask(sigmask);
-  p->signals_mask_backup = backup_mask;
-  
-  //3
-  //debug
-  //printf("on stage 3\n");
-  //turn on flag
-  //acquire(&p->lock);
-  //debug
-  //printf("signum: %d, in userhandler, signal_handling is: %d\n", signum, p->signal_handling);
-  p->signal_handling = 1;
-  //printf("signum: %d, in userhandler, signal_handling is: %d\n", signum, p->signal_handling);
+  act = (struct sigaction*)p->signal_handlers[signum];
+  fr.epc = tf->epc;
+  fr.ra = tf->ra;
+  fr.sp = tf->sp;
+  fr.gp = tf->gp;
+  fr.tp = tf->tp;
+  fr.t[0] = tf->t0;
+  fr.t[1] = tf->t1;
+  fr.t[2] = tf->t2;
+  fr.t[3] = tf->t3;
+  fr.t[4] = tf->t4;
+  fr.t[5] = tf->t5;
+  fr.t[6] = tf->t6;
+  memmove(fr.a, &tf->a0, sizeof(fr.a));
+  if(copyin(p->pagetable, (char*)&handler, (uint64)&act->sa_handler, sizeof(handler)) < 0 ||
+     copyin(p->pagetable, (char*)&mask, (uint64)&act->sigmask, sizeof(mask)) < 0 ||
+     copyout(p->pagetable, sp, (char*)&fr, sizeof(fr)) < 0){
+    p->killed = 1;
+    release(&p->lock);
+    return;
+  }
 
-  //release(&p->lock);
- 
-  //4
-    //debug
-  //printf("on stage 4\n");
-  //reduce the process trapframe stack pointer by the size of trapframe
-  uint64 sp_n = p->trapframe->sp - sizeof(struct trapframe);
-  p->user_tf_backup = (struct trapframe*)sp_n;
-   
-  //5 
-    //debug
-  //printf("on stage 5\n");
-  //backup the process trap frame 
-  copyout(p->pagetable, (uint64)p->user_tf_backup, (char*)p->trapframe, sizeof(struct trapframe));
-  
-  //6    
-  //debug
-  //printf("on stage 6\n");
-  p->trapframe->epc = (uint64)dst;
-  
-  //7
-    //debug
-  //printf("on stage 7\n");
-  int func_size = (endcallsigret - callsigret);
-  sp_n -= func_size;
-  //reduce the trapframe stack pointer by func size
-  p->trapframe->sp = sp_n;
-  
-  //8
-    //debug
-  // printf("on stage 8\n");
-  //copy call_sigret to the process trapframe stack pointer 
-  copyout(p->pagetable, (uint64)(p->trapframe->sp), (char*)&callsigret, func_size); // second arg?????
-  
-  //9
-    //debug
-  // printf("on stage 9\n");
-  //debug
-  printf("inside user handler, signum: %d\n", signum);
-  p->trapframe->a0 = signum;
-  //put at the process return address register the new trapframe sp
-  //debug
-  p->trapframe->ra = sp_n;
-  //p->signals_mask = backup_mask;
-  //p->signal_handling = 1;
-  //debug
-  // printf("after last stage\n");
+  p->signals_mask_backup = sigprocmask(mask);
+  p->signal_handling = 1;
+  p->sigframe = sp;
+  tf->epc = handler;
+  tf->sp = sp;
+  tf->a0 = signum;
+  tf->ra = SIGTRAMP;
   release(&p->lock);
 }
\ No newline at end of file
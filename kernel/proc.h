@@ -32,18 +32,30 @@ struct context {
 
 // Per-CPU state.
 struct cpu {
-  struct proc *proc;          // The process running on this cpu, or null.
+  struct kthread *thread;     // The thread running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+
+  // run queue of RUNNABLE threads waiting for this cpu,
+  // a min-heap on vruntime.
+  struct spinlock rqlock;     // protects rq and nrunnable.
+  struct kthread *rq[NPROC*NTHREAD]; // rq[0] has the least vruntime.
+  int nrunnable;              // number of threads on the run queue.
+  uint64 minvruntime;         // vruntime of the last thread picked; only grows.
+                              // only this cpu writes it.
+  int online;                 // has this cpu entered scheduler()?
+  int idle;                   // in timer_idle() with its clock muted?
+  int tlbgen[NPROC];          // p->tlbgen as of when we last flushed p's ASID.
 };
 
 extern struct cpu cpus[NCPU];
 
-// per-process data for the trap handling code in trampoline.S.
-// sits in a page by itself just under the trampoline page in the
-// user page table. not specially mapped in the kernel page table.
-// the sscratch register points here.
+// per-thread data for the trap handling code in trampoline.S.
+// the trapframes of a process's threads share a page just under
+// the trampoline page in the user page table, one per thread.
+// not specially mapped in the kernel page table.
+// the sscratch register points to the running thread's.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
 // kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
@@ -92,36 +104,137 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
-enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+// What usersignalhandler() saves on the user stack while a
+// handler runs, for sigret() to restore: the interrupted pc
+// and sp, and the registers the calling convention lets the
+// handler change. The handler itself keeps s0-s11.
+struct sigframe {
+  uint64 epc;
+  uint64 ra;
+  uint64 sp;
+  uint64 gp;
+  uint64 tp;
+  uint64 t[7];        // t0-t6
+  uint64 a[8];        // a0-a7
+};
+
+// A loadable segment of a process's executable. Its pages
+// are read in from the file when first touched; see
+// execpagein().
+struct vseg {
+  uint64 va;          // page-aligned start address
+  uint64 end;         // va + memsz
+  uint64 fileend;     // va + filesz; the rest is zero-filled
+  uint off;           // offset of va in the file
+  int text;           // read-only, so pages can be shared
+};
+
+#define NSEG 4        // loadable segments per executable
+
+// A region of user memory set up by mmap(), between p->sz
+// and MMAPTOP. Its pages are faulted in as they are
+// touched; see mmappagein().
+struct vma {
+  uint64 addr;        // page-aligned start; 0 if the slot is free
+  uint64 len;         // a multiple of PGSIZE
+  int prot;           // PROT_ bits
+  int flags;          // MAP_ bits
+  struct file *f;     // the mapped file, or 0 if anonymous
+  uint off;           // offset of addr in the file or segment
+  struct shm *shm;    // the attached segment, or 0; see shm.c
+};
+
+#define NVMA 16       // mmap() regions per process
+
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, STOPPED, ZOMBIE };
+
+// Per-thread state. A process has NTHREAD slots for
+// threads, which share its memory, files and signals.
+struct kthread {
+  struct spinlock lock;
+
+  // t->lock must be held when using these:
+  enum procstate state;        // Thread state
+  void *chan;                  // If non-zero, sleeping on chan
+  struct kthread *wqnext;      // Next sleeper in chan's wait queue
+  int killed;                  // If non-zero, told to exit by another thread
+  int xstate;                  // Exit status to be returned to join()
+  int tid;                     // Thread ID
+  uint64 vruntime;             // time RUNNING, scaled by nice; see scheduler()
+  int vcpu;                    // cpu whose minvruntime vruntime is relative to, or -1
+  int slice;                   // clock ticks left in its quantum; only it uses this
+  int cpu;                     // Affinity hint: cpu it last ran on, or -1
+  uint lastrun;                // ticks when it was last switched in
+  uint64 stamp;                // time CSR when it became RUNNABLE or RUNNING
+  uint64 runtime;              // time CSR ticks spent RUNNING
+  uint64 waittime;             // time CSR ticks spent RUNNABLE
+  uint64 nvcsw;                // switches away to sleep, stop or exit
+  uint64 nivcsw;               // switches away by yield()
+
+  // these are private to the thread, so t->lock need not be held.
+  struct proc *proc;           // Process this thread belongs to
+  uint64 kstack;               // Virtual address of kernel stack
+  struct trapframe *trapframe; // this thread's slot in p->trapframes
+  struct context context;      // swtch() here to run thread
+  struct file *argfiles[2];    // held by argfd() until the system call returns
+};
 
 // Per-process state
 struct proc {
   struct spinlock lock;
 
   // p->lock must be held when using these:
-  enum procstate state;        // Process state
-  void *chan;                  // If non-zero, sleeping on chan
+  enum procstate state;        // Process state: UNUSED, USED or ZOMBIE
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int exiting;                 // A thread is in killothers()
+  int nice;                    // NICE_MIN (most cpu) to NICE_MAX (least)
+  int quantum;                 // clock ticks its threads run before yielding
+  int slot;                    // index in proc[], and ASID - 1; fixed
 
-  // proc_tree_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // first child
+  struct proc *sibling;        // next child of parent
+  struct proc **psibling;      // the pointer to this one
+
+  struct proc *pidnext;        // next in pidhash[] chain; pid_lock
 
   // these are private to the process, so p->lock need not be held.
-  uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
-  struct trapframe *trapframe; // data page for trampoline.S
-  struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  int tlbgen;                  // bumped when cached translations go stale; atomic
+  struct trapframe *trapframes; // data page for trampoline.S, NTHREAD slots
+  struct vproc *vproc;         // page mapped read-only at UPROC; see vdso.h
+  struct kthread *threads;     // NTHREAD of them, each with its own lock
+  struct file **ofile;         // Open files: ofile0, or a page; see fdalloc()
+  struct file *ofile0[NOFILE0];
+  uint64 fdbits[NOFILE/64];    // which fds are taken; p->lock
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Executable that segs are read from, or 0
+  struct vseg segs[NSEG];      // Its loadable segments
+  int nseg;
+  struct vma vmas[NVMA];       // mmap() regions; p->lock must be held
+  struct uring *ring;          // uring_setup() page, or 0; see uring.c
+  int ringbusy;                // a thread is in uring_enter(); p->lock
   char name[16];               // Process name (debugging)
   uint pending_signals;        
   uint signals_mask;
   uint signals_mask_backup;
   void* signal_handlers[32];
-  struct trapframe *user_tf_backup;
+  uint64 sigframe;             // user address of the struct sigframe, or 0
   volatile int stopped;
   int signal_handling;        //indicate if handling the signal. initialize to zero??   
+
+  // scheduler counters of threads that have been freed;
+  // p->lock must be held.
+  uint64 runtime;
+  uint64 waittime;
+  uint64 nvcsw;
+  uint64 nivcsw;
+
+  // system call counts and time, if SYSSTAT; atomic.
+  uint64 ncall[NSYSCALL];
+  uint64 calltime[NSYSCALL];
 };
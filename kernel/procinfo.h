@@ -0,0 +1,21 @@
+// Process information, as returned by getprocinfo().
+// Times and switch counts are summed over the process's
+// threads, including ones that have already exited.
+// Times are in time CSR ticks.
+// The kernel and user programs use this header file.
+
+struct procinfo {
+  int pid;
+  int ppid;
+  char state[8];     // of its most active thread, as in procdump()
+  char name[16];
+  int nice;
+  int quantum;       // clock ticks
+  int nthread;
+  int cpu;           // cpu a thread last ran on, or -1
+  uint64 sz;         // bytes of user memory
+  uint64 runtime;    // running on a cpu
+  uint64 waittime;   // RUNNABLE, waiting for a cpu
+  uint64 nvcsw;      // switches away to sleep, stop or exit
+  uint64 nivcsw;     // switches away by yield(), mostly preemption
+};
@@ -0,0 +1,102 @@
+// Sampling profiler.
+//
+// While profiling is on, each clock interrupt records the
+// pc it interrupted, user or kernel, in a ring that
+// profread() drains. profctl() picks whose samples to keep:
+// one process, every cpu, or none. Samples that arrive
+// while the ring is full are dropped and counted.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "prof.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+  int pid;          // profiling pid, -1 for all, 0 for off
+  uint r;           // next sample to read
+  uint w;           // next sample to write
+  uint dropped;     // samples lost to a full ring
+  struct profsample ring[NPROF];
+} prof;
+
+void
+profinit(void)
+{
+  initlock(&prof.lock, "prof");
+}
+
+// Called on every clock interrupt, with interrupts off,
+// with the pc it interrupted.
+void
+profsample(uint64 pc, int user)
+{
+  struct proc *p;
+  struct profsample *s;
+  int pid;
+
+  if(prof.pid == 0)
+    return;
+  p = myproc();
+  pid = p ? p->pid : 0;
+  if(prof.pid != -1 && prof.pid != pid)
+    return;
+
+  acquire(&prof.lock);
+  if(prof.w - prof.r == NPROF){
+    prof.dropped++;
+  } else {
+    s = &prof.ring[prof.w++ % NPROF];
+    s->pc = pc;
+    s->pid = pid;
+    s->user = user;
+  }
+  release(&prof.lock);
+}
+
+// Sample process pid, or everything if pid is -1, or
+// stop if pid is 0. Starting throws away old samples;
+// stopping keeps them for profread(). Returns the number
+// of samples dropped since profiling last started.
+int
+profctl(int pid)
+{
+  int dropped;
+
+  if(pid < -1)
+    return -1;
+  acquire(&prof.lock);
+  dropped = prof.dropped;
+  if(pid != 0){
+    prof.r = prof.w = 0;
+    prof.dropped = 0;
+  }
+  prof.pid = pid;
+  release(&prof.lock);
+  return dropped;
+}
+
+// Move up to n samples, oldest first, to user address
+// addr. Returns how many it moved.
+int
+profread(uint64 addr, int n)
+{
+  struct profsample s;
+  int i;
+
+  for(i = 0; i < n; i++){
+    acquire(&prof.lock);
+    if(prof.r == prof.w){
+      release(&prof.lock);
+      break;
+    }
+    s = prof.ring[prof.r++ % NPROF];
+    release(&prof.lock);
+    if(copyout(myproc()->pagetable, addr + i*sizeof(s), (char*)&s, sizeof(s)) < 0)
+      return -1;
+  }
+  return i;
+}
@@ -0,0 +1,11 @@
+// Profiling samples, as returned by profread(): the pc a
+// clock interrupt found a cpu at, and whose it was.
+// The kernel and user programs use this header file.
+
+#define NPROF 4096   // samples the kernel buffers
+
+struct profsample {
+  uint64 pc;
+  int pid;     // 0 if the cpu was idle in the scheduler
+  int user;    // 1 if pc is a user address of process pid
+};
@@ -0,0 +1,166 @@
+// Shared-memory segments.
+//
+// shmget() finds or creates a segment of zeroed pages by
+// key; shmat() maps it into the calling process as an
+// mmap() region (see mmapshm()), so every process that
+// attaches a segment maps the same physical pages, and
+// fork() and munmap() treat it like MAP_SHARED memory.
+// shmdt() unmaps it again.
+//
+// Each attachment holds a reference to the segment, and the
+// segment holds one reference (see kdup()) to each page, as
+// does each page table that maps it. A segment is freed when
+// the last attachment goes; one that was never attached
+// stays, so that another process can still attach it.
+// shm.lock protects the table.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NSHM      16
+#define SHMMAXPG  64    // pages per segment
+
+struct shm {
+  int used;
+  int key;            // 0 for a segment only found by id
+  int ref;            // attachments
+  int npages;
+  char *pages[SHMMAXPG];
+};
+
+struct {
+  struct spinlock lock;
+  struct shm seg[NSHM];
+} shm;
+
+void
+shminit(void)
+{
+  initlock(&shm.lock, "shm");
+}
+
+// Caller holds shm.lock.
+static void
+shmfree(struct shm *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++)
+    kfree(s->pages[i]);
+  s->npages = 0;
+  s->key = 0;
+  s->used = 0;
+}
+
+// Return the id of the segment with key, creating one of
+// size bytes if there is none. Key 0 always creates a new
+// segment. Returns -1 if the segment is smaller than size,
+// or the table or memory is full.
+int
+shmget(int key, uint64 size)
+{
+  struct shm *s, *free;
+  int i, n;
+
+  n = PGROUNDUP(size) / PGSIZE;
+  if(n == 0 || n > SHMMAXPG)
+    return -1;
+
+  acquire(&shm.lock);
+  free = 0;
+  for(s = shm.seg; s < &shm.seg[NSHM]; s++){
+    if(s->used && key != 0 && s->key == key){
+      release(&shm.lock);
+      return n <= s->npages ? s - shm.seg : -1;
+    }
+    if(!s->used && free == 0)
+      free = s;
+  }
+  if((s = free) == 0){
+    release(&shm.lock);
+    return -1;
+  }
+  for(i = 0; i < n; i++){
+    if((s->pages[s->npages] = kalloc_zeroed()) == 0){
+      shmfree(s);
+      release(&shm.lock);
+      return -1;
+    }
+    s->npages++;
+  }
+  s->used = 1;
+  s->key = key;
+  s->ref = 0;
+  release(&shm.lock);
+  return s - shm.seg;
+}
+
+// Map segment id into the current process.
+// Returns the address, or -1.
+uint64
+shmattach(int id)
+{
+  struct shm *s;
+  uint64 addr;
+
+  if((s = shmref(id)) == 0)
+    return -1;
+  if((addr = mmapshm(s, (uint64)s->npages * PGSIZE)) == -1)
+    shmput(s);
+  return addr;
+}
+
+// Segment id, with a new reference, or 0.
+struct shm*
+shmref(int id)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return 0;
+  s = &shm.seg[id];
+  acquire(&shm.lock);
+  if(!s->used){
+    release(&shm.lock);
+    return 0;
+  }
+  s->ref++;
+  release(&shm.lock);
+  return s;
+}
+
+// Add a reference to s, for another mmap() region.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shm.lock);
+  s->ref++;
+  release(&shm.lock);
+}
+
+// Drop a reference to s; the last frees it.
+void
+shmput(struct shm *s)
+{
+  acquire(&shm.lock);
+  if(s->ref < 1)
+    panic("shmput");
+  if(--s->ref == 0)
+    shmfree(s);
+  release(&shm.lock);
+}
+
+// Page i of s, with a new reference for a page table.
+// Returns 0 if i is past the end. The caller holds a
+// reference to s, so its pages don't change.
+char*
+shmpage(struct shm *s, uint64 i)
+{
+  if(i >= s->npages)
+    return 0;
+  kdup(s->pages[i]);
+  return s->pages[i];
+}
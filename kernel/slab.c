@@ -0,0 +1,156 @@
+// Slab allocator for small kernel objects.
+//
+// Each slab is one page from kalloc(): a struct slab
+// header, then as many objects of the cache's size as
+// fit. A slab on a cache's list has free objects; full
+// slabs are off the list, and an empty slab goes back
+// to kalloc().
+//
+// In front of the slabs each cpu keeps a magazine of up
+// to MAGSIZE free objects, so most slaballoc() and
+// slabfree() calls only push_off() and touch no lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "slab.h"
+#include "defs.h"
+
+struct obj {
+  struct obj *next;
+};
+
+struct slab {
+  struct slab *next;       // on cache's list of slabs with free objects
+  struct slabcache *cache;
+  struct obj *free;        // free objects in this slab
+  uint inuse;              // objects allocated (or in a magazine)
+};
+
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+void
+slabinit(struct slabcache *sc, char *name, uint size)
+{
+  size = (size + 15) & ~15;
+  if(size < sizeof(struct obj) || SLABHDR + size > PGSIZE)
+    panic("slabinit");
+  initlock(&sc->lock, "slab");
+  sc->name = name;
+  sc->size = size;
+  sc->perslab = (PGSIZE - SLABHDR) / size;
+  sc->slabs = 0;
+  memset(sc->mag, 0, sizeof(sc->mag));
+}
+
+// Carve a fresh page into objects.
+// Caller holds sc->lock.
+static struct slab*
+slabgrow(struct slabcache *sc)
+{
+  struct slab *s;
+  struct obj *o;
+  char *p;
+  uint i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = sc;
+  s->inuse = 0;
+  s->free = 0;
+  p = (char*)s + SLABHDR;
+  for(i = 0; i < sc->perslab; i++){
+    o = (struct obj*)(p + i*sc->size);
+    o->next = s->free;
+    s->free = o;
+  }
+  s->next = sc->slabs;
+  sc->slabs = s;
+  return s;
+}
+
+// Take up to n objects from the slabs into mag.
+static void
+slabtake(struct slabcache *sc, struct magazine *mag, int n)
+{
+  struct slab *s;
+  struct obj *o;
+
+  acquire(&sc->lock);
+  while(mag->n < n){
+    if((s = sc->slabs) == 0 && (s = slabgrow(sc)) == 0)
+      break;
+    o = s->free;
+    s->free = o->next;
+    s->inuse++;
+    if(s->free == 0)
+      sc->slabs = s->next;   // now full
+    mag->obj[mag->n++] = o;
+  }
+  release(&sc->lock);
+}
+
+// Return the top n objects of mag to their slabs.
+static void
+slabgive(struct slabcache *sc, struct magazine *mag, int n)
+{
+  struct slab *s, **pp;
+  struct obj *o;
+
+  acquire(&sc->lock);
+  while(n-- > 0){
+    o = mag->obj[--mag->n];
+    s = (struct slab*)PGROUNDDOWN((uint64)o);
+    if(s->cache != sc)
+      panic("slabfree");
+    if(s->free == 0){
+      // was full: it has a free object again.
+      s->next = sc->slabs;
+      sc->slabs = s;
+    }
+    o->next = s->free;
+    s->free = o;
+    if(--s->inuse == 0){
+      for(pp = &sc->slabs; *pp != s; pp = &(*pp)->next)
+        ;
+      *pp = s->next;
+      kfree((void*)s);
+    }
+  }
+  release(&sc->lock);
+}
+
+// Allocate one object from sc.
+// Returns 0 if out of memory.
+void*
+slaballoc(struct slabcache *sc)
+{
+  struct magazine *mag;
+  void *o;
+
+  push_off();
+  mag = &sc->mag[cpuid()];
+  if(mag->n == 0)
+    slabtake(sc, mag, MAGSIZE/2);
+  o = 0;
+  if(mag->n > 0)
+    o = mag->obj[--mag->n];
+  pop_off();
+  return o;
+}
+
+// Free an object that slaballoc(sc) returned.
+void
+slabfree(struct slabcache *sc, void *o)
+{
+  struct magazine *mag;
+
+  push_off();
+  mag = &sc->mag[cpuid()];
+  if(mag->n == MAGSIZE)
+    slabgive(sc, mag, MAGSIZE/2);
+  mag->obj[mag->n++] = o;
+  pop_off();
+}
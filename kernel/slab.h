@@ -0,0 +1,20 @@
+// Cache of equal-sized small kernel objects, packed into
+// pages from kalloc(); see slab.c.
+
+#define MAGSIZE 8  // objects in a per-cpu magazine
+
+// a cpu's private stack of free objects, used with
+// interrupts off instead of a lock.
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct slabcache {
+  struct spinlock lock;  // protects slabs and the slabs' free lists
+  char *name;
+  uint size;             // object size, rounded up
+  uint perslab;          // objects that fit in one page
+  struct slab *slabs;    // slabs with at least one free object
+  struct magazine mag[NCPU];
+};
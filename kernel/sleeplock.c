@@ -15,6 +15,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->xwaiting = 0;
   lk->pid = 0;
 }
 
@@ -22,31 +24,65 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->xwaiting++;
+  while (lk->locked || lk->readers) {
     sleep(lk, &lk->lk);
   }
+  lk->xwaiting--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
 
+// Acquire lk shared with other readers.
+void
+acquiresleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->xwaiting) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+// Release lk, whichever way it is held.
 void
 releasesleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers > 0){
+    if(--lk->readers == 0)
+      wakeup(lk);
+  } else {
+    lk->locked = 0;
+    lk->pid = 0;
+    wakeup(lk);
+  }
+  release(&lk->lk);
+}
+
+// Turn this process's exclusive hold on lk into a shared one.
+void
+downgradesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
+  lk->readers = 1;
   wakeup(lk);
   release(&lk->lk);
 }
 
+// Does this process hold lk? For a shared lock this can
+// only say that some process holds it.
 int
 holdingsleep(struct sleeplock *lk)
 {
   int r;
   
   acquire(&lk->lk);
-  r = lk->locked && (lk->pid == myproc()->pid);
+  r = (lk->locked && (lk->pid == myproc()->pid)) || lk->readers > 0;
   release(&lk->lk);
   return r;
 }
@@ -1,6 +1,11 @@
 // Long-term locks for processes
+// Held either exclusively, by one process, or shared, by
+// any number of readers. Waiting exclusive lockers hold
+// off new readers, so that they can't starve.
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // processes holding it shared
+  int xwaiting;      // processes waiting to hold it exclusively
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
@@ -7,6 +7,38 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+// statistics for each lock name, filled in by initlock().
+// statlock is a bare flag, since a spinlock would count
+// itself.
+static struct lockstat lockstats[NLOCKSTAT];
+static int nlockstat;
+static uint statlock;
+
+// Find or make the statistics entry for name, or 0 if
+// the table is full.
+static struct lockstat*
+lockstatfor(char *name)
+{
+  struct lockstat *s;
+
+  while(__sync_lock_test_and_set(&statlock, 1) != 0)
+    ;
+  for(s = lockstats; s < &lockstats[nlockstat]; s++)
+    if(strncmp(s->name, name, sizeof(s->name)) == 0)
+      break;
+  if(s == &lockstats[nlockstat]){
+    if(nlockstat < NLOCKSTAT){
+      safestrcpy(s->name, name, sizeof(s->name));
+      nlockstat++;
+    } else {
+      s = 0;
+    }
+  }
+  __sync_lock_release(&statlock);
+  return s;
+}
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -14,6 +46,20 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->stat = LOCKSTAT ? lockstatfor(name) : 0;
+  lk->fair = 0;
+}
+
+// Make lk a ticket lock: acquire() serves cpus in the order
+// they arrive, so none starves under heavy contention, at
+// the price of a slower hand-off between cpus.
+void
+initticketlock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->fair = 1;
+  lk->next = 0;
+  lk->serving = 0;
 }
 
 // Acquire the lock.
@@ -21,6 +67,10 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  struct lockstat *s;
+  uint64 n;
+  uint t;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
@@ -29,8 +79,18 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  n = 0;
+  if(lk->fair){
+    // take a ticket, and wait for it to be served.
+    // On RISC-V, the fetch-and-add is an amoadd.w.
+    t = __sync_fetch_and_add(&lk->next, 1);
+    while(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != t)
+      n++;
+    lk->locked = 1;
+  } else {
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      n++;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,15 +100,33 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+  if(LOCKSTAT && (s = lk->stat) != 0){
+    __sync_fetch_and_add(&s->nacquire, 1);
+    if(n){
+      __sync_fetch_and_add(&s->ncontend, 1);
+      __sync_fetch_and_add(&s->nspin, n);
+    }
+    lk->t0 = r_time();
+  }
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  struct lockstat *s;
+  uint64 d, m;
+
   if(!holding(lk))
     panic("release");
 
+  if(LOCKSTAT && (s = lk->stat) != 0){
+    d = r_time() - lk->t0;
+    while((m = s->maxhold) < d && !__sync_bool_compare_and_swap(&s->maxhold, m, d))
+      ;
+  }
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -66,7 +144,14 @@ release(struct spinlock *lk)
   // On RISC-V, sync_lock_release turns into an atomic swap:
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // A ticket lock is released by serving the next ticket;
+  // only the holder writes lk->serving.
+  if(lk->fair){
+    lk->locked = 0;
+    __atomic_store_n(&lk->serving, lk->serving + 1, __ATOMIC_RELEASE);
+  } else {
+    __sync_lock_release(&lk->locked);
+  }
 
   pop_off();
 }
@@ -81,6 +166,19 @@ holding(struct spinlock *lk)
   return r;
 }
 
+// Is this cpu holding any spinlock (or has it otherwise
+// pushed interrupts off), so that it mustn't sleep?
+int
+holdingany(void)
+{
+  int r;
+
+  push_off();
+  r = mycpu()->noff > 1;
+  pop_off();
+  return r;
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -108,3 +206,17 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Copy up to n lock statistics entries out to user
+// address addr. Returns how many there are in all.
+int
+lockstatcopy(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+
+  if(n > nlockstat)
+    n = nlockstat;
+  if(n > 0 && copyout(p->pagetable, addr, (char*)lockstats, n*sizeof(struct lockstat)) < 0)
+    return -1;
+  return nlockstat;
+}
@@ -1,9 +1,18 @@
 // Mutual exclusion lock.
+// A lock made by initticketlock() is fair: cpus get it in
+// the order they asked, by taking tickets.
 struct spinlock {
   uint locked;       // Is the lock held?
+  int fair;          // a ticket lock?
+  uint next;         // ticket lock: next ticket to hand out
+  uint serving;      // ticket lock: ticket that holds the lock
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For statistics, if LOCKSTAT:
+  struct lockstat *stat; // counters for locks of this name
+  uint64 t0;         // when it was acquired
 };
 
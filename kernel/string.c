@@ -1,13 +1,32 @@
 #include "types.h"
 
+// memset(), memcmp() and memmove() work a 64-bit word at
+// a time when the two addresses have the same alignment,
+// with byte loops for the unaligned head and the tail.
+// Unaligned word accesses could trap on real hardware.
+#define WSIZE sizeof(uint64)
+#define ALIGNED(p) (((uint64)(p) % WSIZE) == 0)
+#define COALIGNED(p, q) ((((uint64)(p) ^ (uint64)(q)) % WSIZE) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+  w = (uchar)c * 0x0101010101010101UL;
+  for(wdst = (uint64*)cdst; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
   }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wdst++ = w;
+  for(cdst = (char*)wdst; n > 0; n--)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +37,14 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(COALIGNED(s1, s2)){
+    for(; n > 0 && !ALIGNED(s1); n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the bytes below find the difference.
+    for(; n >= WSIZE && *(uint64*)s1 == *(uint64*)s2; n -= WSIZE)
+      s1 += WSIZE, s2 += WSIZE;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -38,11 +65,33 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(COALIGNED(s, d)){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *--d = *--s;
+      for(; n >= WSIZE; n -= WSIZE){
+        d -= WSIZE;
+        s -= WSIZE;
+        *(uint64*)d = *(const uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(COALIGNED(s, d)){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *d++ = *s++;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, d += 4*WSIZE, s += 4*WSIZE){
+        ((uint64*)d)[0] = ((const uint64*)s)[0];
+        ((uint64*)d)[1] = ((const uint64*)s)[1];
+        ((uint64*)d)[2] = ((const uint64*)s)[2];
+        ((uint64*)d)[3] = ((const uint64*)s)[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE, d += WSIZE, s += WSIZE)
+        *(uint64*)d = *(const uint64*)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "sysstat.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
@@ -34,20 +35,20 @@ fetchstr(uint64 addr, char *buf, int max)
 static uint64
 argraw(int n)
 {
-  struct proc *p = myproc();
+  struct kthread *t = mythread();
   switch (n) {
   case 0:
-    return p->trapframe->a0;
+    return t->trapframe->a0;
   case 1:
-    return p->trapframe->a1;
+    return t->trapframe->a1;
   case 2:
-    return p->trapframe->a2;
+    return t->trapframe->a2;
   case 3:
-    return p->trapframe->a3;
+    return t->trapframe->a3;
   case 4:
-    return p->trapframe->a4;
+    return t->trapframe->a4;
   case 5:
-    return p->trapframe->a5;
+    return t->trapframe->a5;
   }
   panic("argraw");
   return -1;
@@ -107,6 +108,31 @@ extern uint64 sys_uptime(void);
 extern uint64 sys_sigprocmask(void);
 extern uint64 sys_sigaction(void);
 extern uint64 sys_sigret(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_thread_exit(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_getstats(void);
+extern uint64 sys_profctl(void);
+extern uint64 sys_profread(void);
+extern uint64 sys_getprocinfo(void);
+extern uint64 sys_nice(void);
+extern uint64 sys_quantum(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_shmget(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_pipe2(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_uring_setup(void);
+extern uint64 sys_uring_enter(void);
 
 
 static uint64 (*syscalls[])(void) = {
@@ -134,20 +160,111 @@ static uint64 (*syscalls[])(void) = {
 [SYS_sigprocmask] sys_sigprocmask,
 [SYS_sigaction] sys_sigaction,
 [SYS_sigret]  sys_sigret,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_thread_exit] sys_thread_exit,
+[SYS_lockstat] sys_lockstat,
+[SYS_getstats] sys_getstats,
+[SYS_profctl] sys_profctl,
+[SYS_profread] sys_profread,
+[SYS_getprocinfo] sys_getprocinfo,
+[SYS_nice]    sys_nice,
+[SYS_quantum] sys_quantum,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_poll]    sys_poll,
+[SYS_pipe2]   sys_pipe2,
+[SYS_fcntl]   sys_fcntl,
+[SYS_sendfile] sys_sendfile,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_uring_setup] sys_uring_setup,
+[SYS_uring_enter] sys_uring_enter,
 };
 
+// each cpu counts the system calls that finish on it, so
+// syscall() needs no lock or atomic instruction for these.
+static struct sysstat sysstats[NCPU][NSYSCALL];
+
+// Count a call to num that took d time CSR ticks.
+static void
+sysstat(struct proc *p, int num, uint64 d)
+{
+  struct sysstat *s;
+  int b;
+
+  for(b = 0; d >> (b+1) && b < NSYSHIST-1; b++)
+    ;
+  push_off();
+  s = &sysstats[cpuid()][num];
+  s->ncall++;
+  s->time += d;
+  s->hist[b]++;
+  pop_off();
+
+  // the process's threads may be counting too.
+  __sync_fetch_and_add(&p->ncall[num], 1);
+  __sync_fetch_and_add(&p->calltime[num], d);
+}
+
+// Copy the statistics for up to n system call numbers to
+// user address addr: summed over all cpus if pid is 0, or
+// else just the counts and times of process pid. Returns
+// NSYSCALL, or -1.
+int
+getstats(int pid, uint64 addr, int n)
+{
+  struct proc *p = myproc(), *q;
+  struct sysstat s;
+  int i, c, b;
+
+  if(n > NSYSCALL)
+    n = NSYSCALL;
+  q = 0;
+  if(pid != 0 && (q = findproc(pid)) == 0)
+    return -1;
+
+  for(i = 0; i < n; i++){
+    memset(&s, 0, sizeof(s));
+    if(q){
+      s.ncall = q->ncall[i];
+      s.time = q->calltime[i];
+    } else {
+      for(c = 0; c < NCPU; c++){
+        s.ncall += sysstats[c][i].ncall;
+        s.time += sysstats[c][i].time;
+        for(b = 0; b < NSYSHIST; b++)
+          s.hist[b] += sysstats[c][i].hist[b];
+      }
+    }
+    if(copyout(p->pagetable, addr + i*sizeof(s), (char*)&s, sizeof(s)) < 0)
+      return -1;
+  }
+  return NSYSCALL;
+}
+
 void
 syscall(void)
 {
   int num;
   struct proc *p = myproc();
-  num = p->trapframe->a7;
+  struct kthread *t = mythread();
+  num = t->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    uint64 t0 = r_time();
     //put ret value in register a0
-    p->trapframe->a0 = syscalls[num]();
+    t->trapframe->a0 = syscalls[num]();
+    argfdput();
+    if(SYSSTAT)
+      sysstat(p, num, r_time() - t0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
-    p->trapframe->a0 = -1;
+    t->trapframe->a0 = -1;
   }
 }
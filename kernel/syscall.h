@@ -23,4 +23,29 @@
 #define SYS_sigprocmask 22
 #define SYS_sigaction 23
 #define SYS_sigret 24
+#define SYS_clone  25
+#define SYS_join   26
+#define SYS_thread_exit 27
+#define SYS_lockstat 28
+#define SYS_getstats 29
+#define SYS_profctl 30
+#define SYS_profread 31
+#define SYS_getprocinfo 32
+#define SYS_nice 33
+#define SYS_quantum 34
+#define SYS_mmap 35
+#define SYS_munmap 36
+#define SYS_shmget 37
+#define SYS_shmat 38
+#define SYS_shmdt 39
+#define SYS_poll 40
+#define SYS_pipe2 41
+#define SYS_fcntl 42
+#define SYS_sendfile 43
+#define SYS_pread 44
+#define SYS_pwrite 45
+#define SYS_readv 46
+#define SYS_writev 47
+#define SYS_uring_setup 48
+#define SYS_uring_enter 49
 
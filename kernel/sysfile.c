@@ -15,19 +15,30 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// The file stays open until the system call returns, even if
+// another thread closes fd; see argfdput().
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
-  int fd;
+  int fd, held, i;
   struct file *f;
+  struct kthread *t = mythread();
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdget(myproc(), fd, &held)) == 0)
     return -1;
+  if(held){
+    for(i = 0; i < NELEM(t->argfiles) && t->argfiles[i]; i++)
+      ;
+    if(i == NELEM(t->argfiles))
+      panic("argfd");
+    t->argfiles[i] = f;
+  }
   if(pfd)
     *pfd = fd;
   if(pf)
@@ -35,21 +46,20 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
+// Called by syscall() as each system call returns, to drop
+// the references argfd() took.
+void
+argfdput(void)
 {
-  int fd;
-  struct proc *p = myproc();
+  struct kthread *t = mythread();
+  int i;
 
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
+  for(i = 0; i < NELEM(t->argfiles); i++){
+    if(t->argfiles[i]){
+      fileclose(t->argfiles[i]);
+      t->argfiles[i] = 0;
     }
   }
-  return -1;
 }
 
 uint64
@@ -73,7 +83,7 @@ sys_read(void)
   int n;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0 || n < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -85,25 +95,117 @@ sys_write(void)
   int n;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0 || n < 0)
     return -1;
 
   return filewrite(f, p, n);
 }
 
+// pread(fd, buf, n, off) and pwrite(fd, buf, n, off) read
+// and write at off, leaving the file's own offset alone.
 uint64
-sys_close(void)
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+  uint o;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.base = (void*)p;
+  iov.len = n;
+  o = off;
+  return filereadv(f, &iov, 1, &o);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+  uint o;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.base = (void*)p;
+  iov.len = n;
+  o = off;
+  return filewritev(f, &iov, 1, &o);
+}
+
+// Fetch the iovec array that is the nth argument, with
+// cnt entries, into iov.
+static int
+argiov(int n, int cnt, struct iovec *iov)
+{
+  uint64 p;
+  uint64 tot;
+  int i;
+
+  if(argaddr(n, &p) < 0 || cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, p, cnt * sizeof(struct iovec)) < 0)
+    return -1;
+  // the total has to fit in the int that is returned.
+  tot = 0;
+  for(i = 0; i < cnt; i++)
+    tot += iov[i].len;
+  return tot > 0x7fffffff ? -1 : 0;
+}
+
+// readv(fd, iov, cnt) and writev(fd, iov, cnt).
+uint64
+sys_readv(void)
 {
-  int fd;
   struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, iov) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, 0);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, iov) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, 0);
+}
+
+// Close file descriptor fd of the current process.
+int
+fdclose(int fd)
+{
+  struct file *f;
+
+  if((f = fdtake(myproc(), fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
 
+uint64
+sys_close(void)
+{
+  int fd;
+
+  if(argint(0, &fd) < 0)
+    return -1;
+  return fdclose(fd);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -172,10 +274,11 @@ isdirempty(struct inode *dp)
   int off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  // "." and ".." need not be first in an indexed directory.
+  for(off=0; off<dp->size; off+=sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -218,6 +321,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_enter(dp->dev, dp->inum, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -275,25 +379,32 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+  if(dirlink(dp, name, ip->inum) < 0){
+    // dp is full: give back ip, which iput() frees.
+    if(type == T_DIR){
+      dp->nlink--;
+      iupdate(dp);
+    }
+    iunlockput(dp);
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    return 0;
+  }
 
   iunlockput(dp);
 
   return ip;
 }
 
-uint64
-sys_open(void)
+// Open path, a kernel string, in the current process.
+// Returns the new file descriptor, or -1.
+int
+fileopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op();
 
@@ -340,6 +451,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -351,6 +463,17 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return fileopen(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -454,33 +577,149 @@ sys_exec(void)
   return -1;
 }
 
-uint64
-sys_pipe(void)
+// pipe() and pipe2(): flags may be O_NONBLOCK.
+static int
+mkpipe(uint64 fdarray, int flags)
 {
-  uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
   struct proc *p = myproc();
 
-  if(argaddr(0, &fdarray) < 0)
+  if(flags & ~O_NONBLOCK)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
+  rf->nonblock = wf->nonblock = (flags & O_NONBLOCK) != 0;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdtake(p, fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdtake(p, fd0);
+    fdtake(p, fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+// sendfile(out, in, off, n): copy from in starting at *off,
+// or at in's own offset if off is 0, and advance it.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  uint64 offp;
+  uint off;
+  int n, r;
+  struct proc *p = myproc();
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argaddr(2, &offp) < 0 ||
+     argint(3, &n) < 0)
+    return -1;
+  if(offp == 0)
+    return filesend(out, in, &in->off, n);
+  if(copyin(p->pagetable, (char*)&off, offp, sizeof(off)) < 0)
+    return -1;
+  r = filesend(out, in, &off, n);
+  if(copyout(p->pagetable, offp, (char*)&off, sizeof(off)) < 0)
+    return -1;
+  return r;
+}
+
+uint64
+sys_pipe(void)
+{
+  uint64 fdarray; // user pointer to array of two integers
+
+  if(argaddr(0, &fdarray) < 0)
+    return -1;
+  return mkpipe(fdarray, 0);
+}
+
+uint64
+sys_pipe2(void)
+{
+  uint64 fdarray;
+  int flags;
+
+  if(argaddr(0, &fdarray) < 0 || argint(1, &flags) < 0)
+    return -1;
+  return mkpipe(fdarray, flags);
+}
+
+// fcntl(fd, cmd, arg): only O_NONBLOCK can be read or set.
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  if(cmd == F_GETFL)
+    return f->nonblock ? O_NONBLOCK : 0;
+  if(cmd == F_SETFL){
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+// mmap(addr, len, prot, flags, fd, off): addr is only
+// a hint, and is ignored; see mmap.c.
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, off;
+  struct file *f;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if((prot & ~(PROT_READ|PROT_WRITE|PROT_EXEC)) ||
+     (flags & ~(MAP_SHARED|MAP_PRIVATE|MAP_ANONYMOUS)) ||
+     ((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+
+  f = 0;
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || f->ip->type != T_FILE)
+      return -1;
+    if(off < 0 || off % PGSIZE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  } else {
+    off = 0;
+  }
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+uint64
+sys_poll(void)
+{
+  uint64 fds;
+  int nfds, timeout;
+
+  if(argaddr(0, &fds) < 0 || argint(1, &nfds) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return poll(fds, nfds, timeout);
+}
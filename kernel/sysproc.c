@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "timer.h"
 
 uint64
 sys_exit(void)
@@ -56,18 +57,19 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
+  struct timer t;
 
   if(argint(0, &n) < 0)
     return -1;
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
+  timer_add(&t, ticks + n);
+  while(t.pending){
+    if(killed()){
+      timer_del(&t);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&t, &tickslock);
   }
   release(&tickslock);
   return 0;
@@ -118,6 +120,8 @@ sys_sigaction(void)
   if(argint(0, &signum) < 0 || argaddr(1,(uint64*)&act) < 0 || argaddr(2, (uint64*)&oldact) < 0){
     return -1;
   }
+  // the signal code reads *act with p->lock held.
+  uvmprefault(myproc()->pagetable, (uint64)act, sizeof(*act), 0);
   
   return sigaction(signum, act, oldact);
 }
@@ -125,8 +129,157 @@ sys_sigaction(void)
 uint64
 sys_sigret(void)
 {
-  sigret();
-  return 0;
+  return sigret();
+}
+
+uint64
+sys_lockstat(void)
+{
+  uint64 p;
+  int n;
+
+  if(argaddr(0, &p) < 0 || argint(1, &n) < 0)
+    return -1;
+  return lockstatcopy(p, n);
+}
+
+uint64
+sys_getstats(void)
+{
+  int pid, n;
+  uint64 p;
+
+  if(argint(0, &pid) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0)
+    return -1;
+  return getstats(pid, p, n);
+}
+
+uint64
+sys_profctl(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return profctl(pid);
+}
+
+uint64
+sys_profread(void)
+{
+  uint64 p;
+  int n;
+
+  if(argaddr(0, &p) < 0 || argint(1, &n) < 0)
+    return -1;
+  return profread(p, n);
+}
+
+uint64
+sys_getprocinfo(void)
+{
+  uint64 p;
+  int n;
+
+  if(argaddr(0, &p) < 0 || argint(1, &n) < 0)
+    return -1;
+  return getprocinfo(p, n);
+}
+
+uint64
+sys_nice(void)
+{
+  int pid, n;
+
+  if(argint(0, &pid) < 0 || argint(1, &n) < 0)
+    return -1;
+  return setnice(pid, n);
+}
+
+uint64
+sys_quantum(void)
+{
+  int pid, n;
+
+  if(argint(0, &pid) < 0 || argint(1, &n) < 0)
+    return -1;
+  return setquantum(pid, n);
+}
+
+uint64
+sys_shmget(void)
+{
+  int key;
+  uint64 size;
+
+  if(argint(0, &key) < 0 || argaddr(1, &size) < 0)
+    return -1;
+  return shmget(key, size);
+}
+
+uint64
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmattach(id);
+}
+
+uint64
+sys_shmdt(void)
+{
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  return shmdetach(addr);
+}
+
+uint64
+sys_uring_setup(void)
+{
+  return uring_setup();
+}
+
+uint64
+sys_uring_enter(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return uring_enter(n);
 }
 
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
 
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return join(tid, p);
+}
+
+uint64
+sys_thread_exit(void)
+{
+  int n;
+  if(argint(0, &n) < 0)
+    return -1;
+  thread_exit(n);
+  return 0;  // not reached
+}
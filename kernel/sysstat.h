@@ -0,0 +1,11 @@
+// System call statistics, as returned by getstats(): one
+// entry per system call number, below NSYSCALL (param.h).
+// The kernel and user programs use this header file.
+
+#define NSYSHIST 24
+
+struct sysstat {
+  uint64 ncall;           // calls
+  uint64 time;            // time CSR ticks spent in them
+  uint64 hist[NSYSHIST];  // calls that took 2^i to 2^(i+1)-1 ticks
+};
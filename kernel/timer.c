@@ -0,0 +1,173 @@
+// Timer wheel.
+//
+// Sleepers register a struct timer with a deadline in
+// ticks; clockintr() advances the wheel one slot per tick
+// and wakes up only the timers that expire in that slot.
+//
+// There are two levels of WHEELSIZE slots. Level 0 holds
+// timers due in the next WHEELSIZE ticks, one slot per
+// tick. Level 1 holds later timers, one slot per
+// WHEELSIZE ticks; each time level 0 wraps, the next
+// level 1 slot is cascaded down into level 0. Timers
+// further out than level 1 reaches park in its last slot
+// and are re-sorted each time they are cascaded.
+//
+// Everything here is protected by tickslock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "timer.h"
+#include "defs.h"
+
+#define WHEELBITS 6
+#define WHEELSIZE (1 << WHEELBITS)
+#define WHEELMASK (WHEELSIZE - 1)
+
+// most ticks an idle cpu goes without a clock interrupt.
+#define TICKLESS_MAX 10
+
+struct timer *wheel0[WHEELSIZE];
+struct timer *wheel1[WHEELSIZE];
+
+// in start.c; scratch[5] tells timervec to hold off.
+extern uint64 timer_scratch[NCPU][6];
+
+static void
+wheel_insert(struct timer *t)
+{
+  uint delta = t->expires - ticks;
+  struct timer **slot;
+
+  if(delta < WHEELSIZE)
+    slot = &wheel0[t->expires & WHEELMASK];
+  else if(delta < WHEELSIZE * WHEELSIZE)
+    slot = &wheel1[(t->expires >> WHEELBITS) & WHEELMASK];
+  else
+    slot = &wheel1[((ticks >> WHEELBITS) - 1) & WHEELMASK];
+
+  t->next = *slot;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+static void
+wheel_remove(struct timer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->next = 0;
+  t->pprev = 0;
+}
+
+// Arm t to fire when ticks reaches expires.
+// A deadline that has already passed fires at once.
+// Caller must hold tickslock.
+void
+timer_add(struct timer *t, uint expires)
+{
+  if(!holding(&tickslock))
+    panic("timer_add");
+  t->expires = expires;
+  if((int)(expires - ticks) <= 0){
+    t->pending = 0;
+    return;
+  }
+  t->pending = 1;
+  wheel_insert(t);
+}
+
+// Disarm t if it hasn't fired yet.
+// Caller must hold tickslock.
+void
+timer_del(struct timer *t)
+{
+  if(!holding(&tickslock))
+    panic("timer_del");
+  if(t->pending){
+    wheel_remove(t);
+    t->pending = 0;
+  }
+}
+
+// Called by clockintr() each time ticks advances.
+// Fire the timers due now, waking whoever sleeps on them.
+// Caller must hold tickslock.
+void
+timer_tick(void)
+{
+  struct timer *t, *next;
+
+  if((ticks & WHEELMASK) == 0){
+    t = wheel1[(ticks >> WHEELBITS) & WHEELMASK];
+    wheel1[(ticks >> WHEELBITS) & WHEELMASK] = 0;
+    for(; t; t = next){
+      next = t->next;
+      wheel_insert(t);
+    }
+  }
+
+  while((t = wheel0[ticks & WHEELMASK]) != 0){
+    wheel_remove(t);
+    t->pending = 0;
+    wakeup(t);
+  }
+}
+
+// How many ticks until a timer might fire:
+// the next level 0 slot in use, or else the next
+// cascade if level 1 holds anything.
+// Caller must hold tickslock.
+static uint
+timer_next(void)
+{
+  uint i;
+
+  for(i = 1; i < WHEELSIZE; i++){
+    if(wheel0[(ticks + i) & WHEELMASK])
+      return i;
+  }
+  for(i = 0; i < WHEELSIZE; i++){
+    if(wheel1[i])
+      return WHEELSIZE - (ticks & WHEELMASK);
+  }
+  return TICKLESS_MAX;
+}
+
+// Called by scheduler() with interrupts off when this
+// cpu has nothing to run. Ask timervec to push mtimecmp
+// out to when the next timer is due (at most TICKLESS_MAX
+// ticks), then wait for an interrupt. If a device wakes
+// the cpu sooner, its next clock interrupt still comes at
+// that deadline, so TICKLESS_MAX also bounds how long it
+// may go without preempting. clockintr() counts the ticks
+// that went by unseen, so ticks stays right.
+// The deadline is when ticks will have advanced n times,
+// not n ticks from now: the machine-mode interrupt that
+// moves mtimecmp out also ends the wfi, and the next call
+// must ask for the same time, or it would never come.
+void
+timer_idle(void)
+{
+  uint n;
+  uint64 deadline;
+  int id = cpuid();
+
+  acquire(&tickslock);
+  n = timer_next();
+  if(n > TICKLESS_MAX)
+    n = TICKLESS_MAX;
+  deadline = tickstime + n * TIMER_INTERVAL;
+  release(&tickslock);
+
+  if(n > 1)
+    timer_scratch[id][5] = deadline;
+  asm volatile("wfi");
+  timer_scratch[id][5] = 0;
+}
@@ -0,0 +1,8 @@
+// One-shot kernel timer, kept on the timer wheel in timer.c.
+// Protected by tickslock.
+struct timer {
+  uint expires;          // value of ticks when it fires
+  int pending;           // still on the wheel?
+  struct timer *next;    // wheel slot list
+  struct timer **pprev;  // link that points to this timer
+};
@@ -8,6 +8,7 @@
 
 struct spinlock tickslock;
 uint ticks;
+uint64 tickstime;  // time CSR value ticks was last advanced for
 
 extern char trampoline[], uservec[], userret[];
 
@@ -46,19 +47,20 @@ usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+  struct kthread *t = mythread();
   
   // save user program counter.
-  p->trapframe->epc = r_sepc();
+  t->trapframe->epc = r_sepc();
   
   if(r_scause() == 8){
     // system call
 
-    if(p->killed)
+    if(killed())
       exit(-1);
 
     // sepc points to the ecall instruction,
     // but we want to return to the next instruction.
-    p->trapframe->epc += 4;
+    t->trapframe->epc += 4;
 
     // an interrupt will change sstatus &c registers,
     // so don't enable until done with those registers.
@@ -67,18 +69,25 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p->pagetable, r_stval(), p->sz, r_scause() == 15) == 0){
+    // untouched text or heap page, or copy-on-write page, fixed up.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
     p->killed = 1;
   }
 
-  if(p->killed)
+  if(killed())
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
-    yield();
+  // give up the CPU if this is a timer interrupt
+  // and the quantum is up.
+  if(which_dev == 2){
+    profsample(t->trapframe->epc, 1);
+    if(sched_tick())
+      yield();
+  }
 
   usertrapret();
 }
@@ -90,6 +99,7 @@ void
 usertrapret(void)
 {
   struct proc *p = myproc();
+  struct kthread *t = mythread();
 
   // we're about to switch the destination of traps from
   // kerneltrap() to usertrap(), so turn off interrupts until
@@ -103,10 +113,10 @@ usertrapret(void)
 
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
-  p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
-  p->trapframe->kernel_trap = (uint64)usertrap;
-  p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
+  t->trapframe->kernel_satp = r_satp();         // kernel page table
+  t->trapframe->kernel_sp = t->kstack + PGSIZE; // thread's kernel stack
+  t->trapframe->kernel_trap = (uint64)usertrap;
+  t->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
 
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
@@ -118,16 +128,19 @@ usertrapret(void)
   w_sstatus(x);
 
   // set S Exception Program Counter to the saved user pc.
-  w_sepc(p->trapframe->epc);
+  w_sepc(t->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = proc_satp(p);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
+  // t's trapframe is at the same offset in the TRAPFRAME
+  // page as in p->trapframes.
+  uint64 tf = TRAPFRAME + ((uint64)t->trapframe - (uint64)p->trapframes);
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(tf, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -151,8 +164,12 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  if(which_dev == 2)
+    profsample(sepc, 0);
+
+  // give up the CPU if this is a timer interrupt
+  // and the quantum is up.
+  if(which_dev == 2 && mythread() != 0 && mythread()->state == RUNNING && sched_tick())
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -164,10 +181,31 @@ kerneltrap()
 void
 clockintr()
 {
+  uint64 now = r_time();
+
+  // cpu 0 keeps ticks. the others leave tickslock alone
+  // unless ticks has fallen behind, as it does while cpu 0
+  // is idle (see timer_idle()).
+  if(cpuid() != 0 &&
+     now - __atomic_load_n(&tickstime, __ATOMIC_RELAXED) < 2*TIMER_INTERVAL){
+    klogkick();
+    return;
+  }
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  // start half a tick back so that jitter in interrupt
+  // latency doesn't make ticks stutter.
+  if(tickstime == 0)
+    tickstime = now - TIMER_INTERVAL - TIMER_INTERVAL/2;
+  // count every tick that has gone by since the last one.
+  while(now - tickstime >= TIMER_INTERVAL){
+    tickstime += TIMER_INTERVAL;
+    ticks++;
+    timer_tick();
+  }
+  vdsotick(ticks, tickstime);
   release(&tickslock);
+  klogkick();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -206,9 +244,7 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
+    clockintr();
     
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
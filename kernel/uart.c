@@ -35,12 +35,16 @@
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
 #define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
 
+// with FIFOs enabled, LSR_TX_IDLE means the whole transmit
+// FIFO is empty, so this many bytes can go in at once.
+#define UART_FIFO_SIZE 16
+
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
 // the transmit output buffer.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE 512
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uar_tx_r % UART_TX_BUF_SIZE]
@@ -108,6 +112,37 @@ uartputc(int c)
   }
 }
 
+// add n bytes to the output buffer, with one acquire
+// of uart_tx_lock unless the buffer fills up, and tell
+// the UART to start sending. like uartputc(), it may
+// block, so it's only suitable for use by write().
+void
+uartwrite(char *buf, int n)
+{
+  int i;
+
+  acquire(&uart_tx_lock);
+
+  if(panicked){
+    for(;;)
+      ;
+  }
+
+  for(i = 0; i < n; ){
+    if(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full. start sending what is there, and
+      // wait for uartstart() to open up space.
+      uartstart();
+      sleep(&uart_tx_r, &uart_tx_lock);
+    } else {
+      while(i < n && uart_tx_w < uart_tx_r + UART_TX_BUF_SIZE)
+        uart_tx_buf[uart_tx_w++ % UART_TX_BUF_SIZE] = buf[i++];
+    }
+  }
+  uartstart();
+  release(&uart_tx_lock);
+}
+
 // alternate version of uartputc() that doesn't 
 // use interrupts, for use by kernel printf() and
 // to echo characters. it spins waiting for the uart's
@@ -130,34 +165,33 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the transmit buffer, fill its FIFO with them.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
 void
 uartstart()
 {
-  while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
-    
-    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
-    }
-    
-    int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
+  int i;
+
+  if(uart_tx_w == uart_tx_r){
+    // transmit buffer is empty.
+    return;
+  }
+
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+    // the UART transmit FIFO is not yet empty.
+    // it will interrupt when it's ready for more.
+    return;
+  }
+
+  for(i = 0; i < UART_FIFO_SIZE && uart_tx_r != uart_tx_w; i++){
+    WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
     uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
-    WriteReg(THR, c);
   }
+
+  // maybe uartputc() or uartwrite() is waiting for space.
+  wakeup(&uart_tx_r);
 }
 
 // read one input character from the UART.
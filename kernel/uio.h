@@ -0,0 +1,9 @@
+// Buffers for readv() and writev().
+// The kernel and user programs use this header file.
+
+#define IOV_MAX 16   // buffers per call
+
+struct iovec {
+  void *base;
+  uint len;
+};
@@ -0,0 +1,150 @@
+//
+// Batched system calls through a ring shared with user
+// space (see uring.h), so that a process can queue many
+// reads, writes, opens and closes and have them all run in
+// one uring_enter() call, paying for one trap instead of
+// one per operation.
+//
+// The ring is a one-page shared-memory segment (shm.c),
+// attached by uring_setup(); the kernel holds its own
+// reference to the page in p->ring, so it stays while the
+// process lives even if user space unmaps it. Each entry
+// is copied out of the ring before it is checked, since
+// user space can change the ring at any time.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "uio.h"
+#include "uring.h"
+
+// Make a ring for the current process, and map it.
+// Returns its user address, or -1.
+uint64
+uring_setup(void)
+{
+  struct proc *p = myproc();
+  struct shm *s;
+  uint64 addr;
+  int id;
+
+  if(sizeof(struct uring) > PGSIZE)
+    panic("uring_setup");
+  if(p->ring)
+    return -1;
+  if((id = shmget(0, PGSIZE)) < 0 || (addr = shmattach(id)) == -1)
+    return -1;
+  // another thread may have detached it already.
+  if((s = shmref(id)) == 0)
+    return -1;
+  p->ring = (struct uring*)shmpage(s, 0);
+  shmput(s);
+  return addr;
+}
+
+// Drop p's reference to its ring, for exec() and exit().
+void
+uring_free(struct proc *p)
+{
+  if(p->ring)
+    kfree(p->ring);
+  p->ring = 0;
+}
+
+// Run one submission, as the system call would.
+static int
+uring_run(struct usqe *e)
+{
+  struct proc *p = myproc();
+  struct file *f;
+  struct iovec iov;
+  char path[MAXPATH];
+  uint off;
+  int held, r;
+
+  if(e->op == UOP_NOP)
+    return 0;
+  if(e->op == UOP_OPEN){
+    if(copyinstr(p->pagetable, path, e->addr, MAXPATH) < 0)
+      return -1;
+    return fileopen(path, e->n);
+  }
+  if(e->op == UOP_CLOSE)
+    return fdclose(e->fd);
+
+  if(e->n < 0 || (f = fdget(p, e->fd, &held)) == 0)
+    return -1;
+  iov.base = (void*)e->addr;
+  iov.len = e->n;
+  off = e->off;
+  switch(e->op){
+  case UOP_READ:
+    r = filereadv(f, &iov, 1, 0);
+    break;
+  case UOP_WRITE:
+    r = filewritev(f, &iov, 1, 0);
+    break;
+  case UOP_PREAD:
+    r = filereadv(f, &iov, 1, &off);
+    break;
+  case UOP_PWRITE:
+    r = filewritev(f, &iov, 1, &off);
+    break;
+  default:
+    r = -1;
+  }
+  if(held)
+    fileclose(f);
+  return r;
+}
+
+// Run up to n submitted entries, in order, stopping early
+// if the completion ring is full. Only one thread of a
+// process may be in here at a time. Returns the number of
+// entries run, or -1.
+int
+uring_enter(int n)
+{
+  struct proc *p = myproc();
+  struct uring *r = p->ring;
+  struct usqe e;
+  uint head, cqtail;
+  int done;
+
+  if(r == 0)
+    return -1;
+  acquire(&p->lock);
+  if(p->ringbusy){
+    release(&p->lock);
+    return -1;
+  }
+  p->ringbusy = 1;
+  release(&p->lock);
+
+  for(done = 0; done < n && !killed(); done++){
+    head = r->sqhead;
+    if(head == __atomic_load_n(&r->sqtail, __ATOMIC_ACQUIRE))
+      break;
+    cqtail = r->cqtail;
+    if(cqtail - __atomic_load_n(&r->cqhead, __ATOMIC_ACQUIRE) >= URING_ENTRIES)
+      break;
+    e = r->sq[head % URING_ENTRIES];
+    __atomic_store_n(&r->sqhead, head + 1, __ATOMIC_RELEASE);
+
+    r->cq[cqtail % URING_ENTRIES].data = e.data;
+    r->cq[cqtail % URING_ENTRIES].res = uring_run(&e);
+    __atomic_store_n(&r->cqtail, cqtail + 1, __ATOMIC_RELEASE);
+  }
+
+  acquire(&p->lock);
+  p->ringbusy = 0;
+  release(&p->lock);
+  return done;
+}
@@ -0,0 +1,43 @@
+// A submission and completion ring, shared between a
+// process and the kernel in one page; see uring.c.
+// User space fills in sq[sqtail % URING_ENTRIES] and
+// advances sqtail, then calls uring_enter(). The kernel
+// runs entries from sqhead, and puts a completion in
+// cq[cqtail % URING_ENTRIES] for each. User space
+// consumes completions by advancing cqhead.
+// The kernel and user programs use this header file.
+
+#define URING_ENTRIES 64
+
+// operations
+#define UOP_NOP    0
+#define UOP_READ   1   // read(fd, addr, n)
+#define UOP_WRITE  2   // write(fd, addr, n)
+#define UOP_PREAD  3   // pread(fd, addr, n, off)
+#define UOP_PWRITE 4   // pwrite(fd, addr, n, off)
+#define UOP_OPEN   5   // open(addr, n): n is the mode
+#define UOP_CLOSE  6   // close(fd)
+
+struct usqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int n;
+  uint off;
+  uint64 data;      // copied to the completion
+};
+
+struct ucqe {
+  uint64 data;
+  int res;          // what the system call would return
+  int pad;
+};
+
+struct uring {
+  uint sqhead;      // advanced by the kernel
+  uint sqtail;      // advanced by user space
+  uint cqhead;      // advanced by user space
+  uint cqtail;      // advanced by the kernel
+  struct usqe sq[URING_ENTRIES];
+  struct ucqe cq[URING_ENTRIES];
+};
@@ -0,0 +1,43 @@
+// The page at USHARED that every process can read (see
+// vdso.h): clockintr() publishes ticks in it, so that
+// uptime() in user/ulib.c needn't trap to read ticks under
+// tickslock. Updates bump seq before and after, so a
+// reader that sees seq odd, or changed, retries.
+// Each process's own page at UPROC is set up by allocproc().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+#include "vdso.h"
+
+struct vdso *vdso;
+
+void
+vdsoinit(void)
+{
+  if((vdso = kalloc_zeroed()) == 0)
+    panic("vdsoinit");
+  vdso->interval = TIMER_INTERVAL;
+}
+
+// The physical page, for proc_pagetable() to map.
+uint64
+vdsopage(void)
+{
+  return (uint64)vdso;
+}
+
+// Called by clockintr() with tickslock held.
+void
+vdsotick(uint ticks, uint64 tickstime)
+{
+  vdso->seq++;
+  __sync_synchronize();
+  vdso->ticks = ticks;
+  vdso->tickstime = tickstime;
+  __sync_synchronize();
+  vdso->seq++;
+}
@@ -0,0 +1,17 @@
+// Pages the kernel maps read-only into every process,
+// so that user code can read them without a system call;
+// see vdso.c and user/ulib.c.
+// The kernel and user programs use this header file.
+
+// At USHARED, the same page in every process.
+struct vdso {
+  uint seq;             // odd while the kernel is updating
+  uint ticks;           // as returned by uptime()
+  uint64 tickstime;     // time CSR value when ticks last advanced
+  uint64 interval;      // time CSR ticks per clock tick
+};
+
+// At UPROC, a page of the process's own.
+struct vproc {
+  int pid;
+};
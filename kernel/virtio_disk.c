@@ -54,6 +54,7 @@ static struct disk {
   struct virtq_used *used;
 
   // our own book-keeping.
+  int num;         // descriptors in use: NUM, or the device's max
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
 
@@ -63,6 +64,7 @@ static struct disk {
   struct {
     struct buf *b;
     char status;
+    char async;   // virtio_disk_intr() finishes it, for breadahead()
   } info[NUM];
 
   // disk command headers.
@@ -119,9 +121,10 @@ virtio_disk_init(void)
   uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
-  if(max < NUM)
+  if(max < 4)
     panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  disk.num = max < NUM ? max : NUM;
+  *R(VIRTIO_MMIO_QUEUE_NUM) = disk.num;
   memset(disk.pages, 0, sizeof(disk.pages));
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
@@ -130,11 +133,11 @@ virtio_disk_init(void)
   // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
 
   disk.desc = (struct virtq_desc *) disk.pages;
-  disk.avail = (struct virtq_avail *)(disk.pages + NUM*sizeof(struct virtq_desc));
+  disk.avail = (struct virtq_avail *)(disk.pages + disk.num*sizeof(struct virtq_desc));
   disk.used = (struct virtq_used *) (disk.pages + PGSIZE);
 
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
+  // all the descriptors start out unused.
+  for(int i = 0; i < disk.num; i++)
     disk.free[i] = 1;
 
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
@@ -144,7 +147,7 @@ virtio_disk_init(void)
 static int
 alloc_desc()
 {
-  for(int i = 0; i < NUM; i++){
+  for(int i = 0; i < disk.num; i++){
     if(disk.free[i]){
       disk.free[i] = 0;
       return i;
@@ -157,7 +160,7 @@ alloc_desc()
 static void
 free_desc(int i)
 {
-  if(i >= NUM)
+  if(i >= disk.num)
     panic("free_desc 1");
   if(disk.free[i])
     panic("free_desc 2");
@@ -184,12 +187,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,25 +202,24 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// allocate three descriptors.
+// single-block transfers use three descriptors.
+static int
+alloc3_desc(int *idx)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  return alloc_descs(idx, 3);
+}
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
+// fill in the n+2 descriptors idx[] for a transfer of the n
+// bufs in bs, which are consecutive blocks on disk starting
+// at bs[0]->blockno, and put the chain on the avail ring.
+// the device doesn't look until the caller notifies it.
+// caller holds vdisk_lock.
+static void
+postv(struct buf **bs, int n, int write, int *idx)
+{
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
+  int i;
 
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
@@ -237,45 +238,140 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  // one descriptor for each block's data.
+  for(i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) bs[i-1]->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record struct buf for virtio_disk_intr(); a multi-block
+  // transfer is finished when its first buf is.
+  bs[0]->disk = 1;
+  disk.info[idx[0]].b = bs[0];
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % disk.num] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
+}
+
+// Start reads (or writes) of the n locked bufs in bs, with
+// one notification to the device for all of them, and
+// return without waiting for the disk.
+// If async is zero, the caller waits for each buf with
+// virtio_disk_wait(); this may sleep for descriptors.
+// If async is set, virtio_disk_intr() calls bdone() on
+// each buf when it finishes; this never sleeps, and queues
+// as many as there are descriptors for.
+// Returns the number of bufs started, from the front of bs.
+int
+virtio_disk_start(struct buf **bs, int n, int write, int async)
+{
+  int i, idx[3];
+
+  acquire(&disk.vdisk_lock);
+  plicroute(VIRTIO0_IRQ);  // finish the transfers on this hart
 
+  // the spec's Section 5.2 says that legacy block operations use
+  // three descriptors: one for type/reserved/sector, one for the
+  // data, one for a 1-byte status result.
+  for(i = 0; i < n; i++){
+    // allocate the three descriptors.
+    while(alloc3_desc(idx) != 0){
+      if(async)
+        goto out;
+      // let the device start on what is queued already.
+      *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    disk.info[idx[0]].async = async;
+    postv(&bs[i], 1, write, idx);
+  }
+
+ out:
   __sync_synchronize();
+  if(i > 0)
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  release(&disk.vdisk_lock);
+  return i;
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
+// Wait for the transfer of b that virtio_disk_start() began.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(&b, 1, write, 0);
+  virtio_disk_wait(b);
+}
+
+// most blocks in one multi-block request.
+#define MAXSEG 16
+
+// Read or write the n bufs in bs, which must be for
+// consecutive blocks on disk (bs[i]->blockno is
+// bs[0]->blockno + i), as requests of up to MAXSEG blocks
+// each, and wait for them all. The bufs need not be
+// next to each other in memory.
+void
+virtio_disk_rwv(struct buf **bs, int n, int write)
+{
+  int i, m, idx[MAXSEG+2];
 
+  acquire(&disk.vdisk_lock);
+  plicroute(VIRTIO0_IRQ);
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > MAXSEG)
+      m = MAXSEG;
+    if(m + 2 > disk.num)
+      m = disk.num - 2;
+    while(alloc_descs(idx, m + 2) != 0){
+      *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    disk.info[idx[0]].async = 0;
+    postv(&bs[i], m, write, idx);
+  }
+  __sync_synchronize();
+  if(n > 0)
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+
+  // each request is done when its first buf is.
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > MAXSEG)
+      m = MAXSEG;
+    if(m + 2 > disk.num)
+      m = disk.num - 2;
+    while(bs[i]->disk == 1)
+      sleep(bs[i], &disk.vdisk_lock);
+  }
   release(&disk.vdisk_lock);
 }
 
@@ -299,14 +395,19 @@ virtio_disk_intr()
 
   while(disk.used_idx != disk.used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = disk.used->ring[disk.used_idx % disk.num].id;
 
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
     b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    if(disk.info[id].async)
+      bdone(b);    // no one is waiting
+    else
+      wakeup(b);
 
     disk.used_idx += 1;
   }
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -15,6 +17,18 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// set if a cpu has too few ASID bits for one ASID per
+// process; then all processes use ASID 0 and trampoline.S
+// flushes the TLB on every switch.
+int noasid;
+
+// protects kernel_pagetable once other cpus are using it.
+struct spinlock kvm_lock;
+
+// serializes uvmfault(), so that two threads faulting on
+// the same page don't both fill it in.
+struct spinlock fault_lock;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -43,9 +57,6 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // map kernel stacks
-  proc_mapstacks(kpgtbl);
-  
   return kpgtbl;
 }
 
@@ -54,6 +65,24 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  initlock(&kvm_lock, "kvm");
+  initlock(&fault_lock, "fault");
+}
+
+// Map the kernel stack page pa at va, which allocthread()
+// chose for a new thread slot. Nothing has been mapped at va
+// before, so no cpu's TLB can hold an entry for it.
+// Returns 0, or -1 if a page-table page can't be allocated.
+int
+kvmmapstack(uint64 va, uint64 pa)
+{
+  int r;
+
+  acquire(&kvm_lock);
+  r = mappages(kernel_pagetable, va, PGSIZE, pa, PTE_R | PTE_W);
+  release(&kvm_lock);
+  sfence_vma();
+  return r;
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -61,6 +90,14 @@ kvminit(void)
 void
 kvminithart()
 {
+  uint64 asids;
+
+  // bits of the ASID field that don't stick aren't implemented.
+  w_satp(MAKE_SATP_ASID(kernel_pagetable, SATP_ASIDMASK));
+  asids = (r_satp() >> SATP_ASIDSHIFT) & SATP_ASIDMASK;
+  if(asids < NPROC)
+    noasid = 1;
+
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
@@ -86,11 +123,12 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & (PTE_R|PTE_W|PTE_X))
+        panic("walk: megapage");
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -120,14 +158,57 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
+// Map one 2MB megapage: a leaf PTE in a level-1 page-table page.
+// va and pa must be aligned to MEGAPGSIZE.
+static int
+mapmega(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V){
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((pagetable = (pde_t*)kalloc_zeroed()) == 0)
+      return -1;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  pte = &pagetable[PX(1, va)];
+  if(*pte & PTE_V)
+    panic("mapmega: remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  return 0;
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// the parts of the range that are 2MB-aligned in both
+// va and pa get megapages, to save page-table pages
+// and TLB entries; the rest get 4096-byte pages.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 n;
+
+  sz = PGROUNDUP(sz);
+  while(sz > 0){
+    if(va % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && sz >= MEGAPGSIZE){
+      if(mapmega(kpgtbl, va, pa, perm) != 0)
+        panic("kvmmap");
+      n = MEGAPGSIZE;
+    } else {
+      // small pages up to the next 2MB boundary.
+      n = MEGAPGSIZE - va % MEGAPGSIZE;
+      if(n > sz)
+        n = sz;
+      if(mappages(kpgtbl, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -169,10 +250,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+    // sbrk()ed pages that were never touched aren't mapped.
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -189,10 +269,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -206,8 +285,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -225,12 +303,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -290,40 +367,223 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table; the physical memory
+// is shared copy-on-write, or copied now if eager
+// is set.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 sz, int eager)
+{
+  return uvmcopyrange(old, new, 0, sz, 0, eager);
+}
+
+// Like uvmcopy(), for the pages from va to end. If share
+// is set, writable pages stay writable in both page tables,
+// as for a MAP_SHARED region.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 va, uint64 end, int share, int eager)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
   char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  for(i = va; i < end; i += PGSIZE){
+    // the child can fault in untouched heap pages itself.
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+    // write-protecting the old page table would leave
+    // writable TLB entries on cpus running its other
+    // threads, so the child gets its own copy instead.
+    if(!share && eager && (*pte & PTE_W)){
+      if((mem = kalloc()) == 0)
+        goto err;
+      memmove(mem, (char*)pa, PGSIZE);
+      if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+        kfree(mem);
+        goto err;
+      }
+      continue;
     }
+    // share writable pages read-only in both page
+    // tables; the first store copies (see uvmfault()).
+    if(!share && (*pte & PTE_W)){
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      flags = PTE_FLAGS(*pte);
+    }
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
+      goto err;
+    kdup((void*)pa);
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
+// Handle a page fault at va, or make va usable before the
+// kernel touches it on the user's behalf:
+//  - a page below sz that was never touched gets a page
+//    of the executable if it holds program text or data
+//    (exec() only notes where they are; text is shared
+//    copy-on-write through the page cache), or a zeroed
+//    page (sbrk() only reserves address space);
+//  - a page above sz that was never touched gets its
+//    contents if it is in an mmap() region;
+//  - a store to a page shared copy-on-write gets a
+//    private copy, or just write access if nothing else
+//    shares it any more.
+// Returns 0 if the access can be retried, -1 if it
+// is a real fault or memory ran out.
+int
+uvmfault(pagetable_t pagetable, uint64 va, uint64 sz, int write)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem, *fill;
+  int perm, r = -1, changed = 0;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  // fill a missing page before taking fault_lock, since
+  // reading the executable or a mapped file can sleep. another thread may
+  // map the page meanwhile; then fill is thrown away.
+  fill = 0;
+  perm = 0;
+  pte = walk(pagetable, va, 0);
+  if(va < sz && (pte == 0 || (*pte & PTE_V) == 0)){
+    if((perm = execpagein(pagetable, va, &fill)) < 0)
+      return -1;
+    if(perm == 0){
+      // not from the executable: bss or heap.
+      if((fill = kalloc_zeroed()) == 0)
+        return -1;
+      perm = PTE_W|PTE_X|PTE_R|PTE_U;
+    }
+  } else if(va >= sz && (pte == 0 || (*pte & PTE_V) == 0)){
+    if((perm = mmappagein(pagetable, va, write, &fill)) <= 0)
+      return -1;
+  }
+
+  acquire(&fault_lock);
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(fill && mappages(pagetable, va, PGSIZE, (uint64)fill, perm) == 0){
+      fill = 0;
+      r = 0;
+      changed = 1;
+    }
+  } else if((*pte & PTE_U) == 0){
+    r = -1;
+  } else if(!write){
+    // another thread may have got here first.
+    r = (*pte & PTE_R) ? 0 : -1;
+  } else if(*pte & PTE_COW){
+    pa = PTE2PA(*pte);
+    flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    if(krefs((void*)pa) == 1){
+      *pte = PA2PTE(pa) | flags;
+      r = 0;
+      changed = 1;
+    } else if((mem = kalloc()) != 0){
+      memmove(mem, (char*)pa, PGSIZE);
+      *pte = PA2PTE(mem) | flags;
+      kfree((void*)pa);
+      r = 0;
+      changed = 1;
+    }
+  } else {
+    r = (*pte & PTE_W) ? 0 : -1;
+  }
+  release(&fault_lock);
+  if(fill)
+    kfree(fill);
+  if(changed)
+    tlbstale(myproc());
+  return r;
+}
+
+// The last-level page-table page that uvmaddr() used, so
+// that a copy spanning many pages walks from the root only
+// once per 2MB. Page-table pages aren't freed while the
+// page table is in use, so the pointer stays good.
+struct uwalk {
+  uint64 va;     // first virtual address that ptes maps
+  pte_t *ptes;   // 0 if nothing cached yet
+};
+
+static pte_t*
+uwalk(pagetable_t pagetable, struct uwalk *w, uint64 va)
+{
+  pte_t *pte;
+
+  if(w->ptes && va - w->va < MEGAPGSIZE)
+    return &w->ptes[PX(0, va)];
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return 0;
+  w->va = va & ~(MEGAPGSIZE - 1);
+  w->ptes = pte - PX(0, va);
+  return pte;
+}
+
+// Like walkaddr(), but first deals with what would
+// fault if the user made the access: see uvmfault().
+static uint64
+uvmaddr(pagetable_t pagetable, struct uwalk *w, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  uint64 sz = 0;
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = uwalk(pagetable, w, va);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_COW))){
+    if(p && p->pagetable == pagetable)
+      sz = p->sz;
+    if(uvmfault(pagetable, va, sz, write) < 0)
+      return 0;
+    // the fault may have added a page-table page.
+    if((pte = uwalk(pagetable, w, va)) == 0)
+      return 0;
+  }
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  // the user can't have the kernel store to read-only
+  // pages, such as the ones at USHARED and UPROC.
+  if(write && (*pte & PTE_W) == 0)
+    return 0;
+  // so that munmap() writes back what the kernel stored.
+  if(write)
+    *pte |= PTE_A | PTE_D;
+  return PTE2PA(*pte);
+}
+
+// Make the user pages from va to va+len present now, as
+// if the user had touched them, so that a copy made later
+// while holding a spinlock needn't read the executable,
+// which would sleep. Bad addresses are left for the copy
+// itself to fail on.
+void
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  struct uwalk w;
+  uint64 a;
+
+  w.ptes = 0;
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if(uvmaddr(pagetable, &w, a, write) == 0)
+      break;
+  }
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -344,10 +604,11 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct uwalk w = { 0, 0 };
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, &w, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -369,10 +630,11 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct uwalk w = { 0, 0 };
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, &w, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -387,6 +649,29 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// Does the word have a zero byte?
+#define HASZERO(x) (((x) - 0x0101010101010101UL) & ~(x) & 0x8080808080808080UL)
+
+// The length of the string at s, or n if there's no '\0'
+// in the first n bytes. Looks a word at a time once s is
+// aligned; aligned words never cross into the next page.
+static uint64
+scannul(char *s, uint64 n)
+{
+  uint64 i = 0;
+
+  for(; i < n && ((uint64)(s + i) % sizeof(uint64)) != 0; i++)
+    if(s[i] == '\0')
+      return i;
+  for(; i + sizeof(uint64) <= n; i += sizeof(uint64))
+    if(HASZERO(*(uint64*)(s + i)))
+      break;
+  for(; i < n; i++)
+    if(s[i] == '\0')
+      return i;
+  return n;
+}
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -394,12 +679,12 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
-  int got_null = 0;
+  uint64 n, k, va0, pa0;
+  struct uwalk w = { 0, 0 };
 
-  while(got_null == 0 && max > 0){
+  while(max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, &w, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -407,25 +692,15 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       n = max;
 
     char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
-      }
-      --n;
-      --max;
-      p++;
-      dst++;
+    k = scannul(p, n);
+    memmove(dst, p, k);
+    if(k < n){
+      dst[k] = '\0';
+      return 0;
     }
-
+    max -= n;
+    dst += n;
     srcva = va0 + PGSIZE;
   }
-  if(got_null){
-    return 0;
-  } else {
-    return -1;
-  }
+  return -1;
 }
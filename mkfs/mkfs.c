@@ -19,27 +19,34 @@
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+//
+// The image is built in memory and written out in one go at
+// the end; the blocks past the last one used are left as a
+// hole in the file, which reads as zeroes.
+
+uint fssize = FSSIZE;      // see -s
+uint ninodes = NINODES;    // see -i
+int nbitmap;
+int ninodeblocks;
+int nlog = 2*(LOGSIZE+1);  // two log regions, each with a header; see -l
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+char *img;
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
 
 void balloc(int);
+char *sect(uint);
 void wsect(uint, void*);
-void winode(uint, struct dinode*);
-void rinode(uint inum, struct dinode *ip);
-void rsect(uint sec, void *buf);
+struct dinode *dinode(uint inum);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint inum, struct dirent *de, int n);
+void writeimg(void);
 
 // convert to intel byte order
 ushort
@@ -69,48 +76,88 @@ main(int argc, char *argv[])
 {
   int i, cc, fd;
   uint rootino, inum, off;
-  struct dirent de;
+  struct dirent de, *rootde;
+  int nrootde;
   char buf[BSIZE];
-  struct dinode din;
+  struct dinode *din;
+  char *usage = "Usage: mkfs [-l logsize] [-s blocks] [-i inodes] fs.img files...\n";
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  while(argc > 2 && argv[1][0] == '-'){
+    i = atoi(argv[2]);
+    if(strcmp(argv[1], "-l") == 0){
+      // room for i blocks in each log transaction.
+      if(i < MAXOPBLOCKS || i > MAXLOG){
+        fprintf(stderr, "mkfs: log size must be %d to %d\n", MAXOPBLOCKS, (int)MAXLOG);
+        exit(1);
+      }
+      nlog = 2*(i+1);
+    } else if(strcmp(argv[1], "-s") == 0){
+      // the size of the file system, in blocks.
+      if(i <= 0){
+        fprintf(stderr, "mkfs: bad size %s\n", argv[2]);
+        exit(1);
+      }
+      fssize = i;
+    } else if(strcmp(argv[1], "-i") == 0){
+      // how many inodes, counting the unused inode 0.
+      if(i <= ROOTINO){
+        fprintf(stderr, "mkfs: bad inode count %s\n", argv[2]);
+        exit(1);
+      }
+      ninodes = i;
+    } else {
+      fprintf(stderr, "%s", usage);
+      exit(1);
+    }
+    argc -= 2;
+    argv += 2;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "%s", usage);
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
+  // 1 fs block = 1 disk sector
+  nbitmap = fssize/BPB + 1;
+  ninodeblocks = ninodes/IPB + 1;
+  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  if(nmeta >= fssize){
+    fprintf(stderr, "mkfs: %u blocks leave no room for data\n", fssize);
+    exit(1);
+  }
+  nblocks = fssize - nmeta;
+
+  if((img = calloc(fssize, BSIZE)) == 0){
+    perror("calloc");
+    exit(1);
+  }
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
     perror(argv[1]);
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
-
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
@@ -118,15 +165,16 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  // the root's entries are written at the end, so that
+  // dirappend() can index them if there are many.
+  rootde = calloc(argc, sizeof(de));
+  nrootde = 0;
+
+  rootde[nrootde].inum = xshort(rootino);
+  strcpy(rootde[nrootde++].name, ".");
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  rootde[nrootde].inum = xshort(rootino);
+  strcpy(rootde[nrootde++].name, "..");
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -152,10 +200,8 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootde[nrootde].inum = xshort(inum);
+    strncpy(rootde[nrootde++].name, shortname, DIRSIZ);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -163,143 +209,223 @@ main(int argc, char *argv[])
     close(fd);
   }
 
+  dirappend(rootino, rootde, nrootde);
+
   // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  din = dinode(rootino);
+  off = xint(din->size);
+  off = ((off + BSIZE - 1)/BSIZE) * BSIZE;
+  din->size = xint(off);
 
   balloc(freeblock);
+  writeimg();
 
   exit(0);
 }
 
-void
-wsect(uint sec, void *buf)
+// Block sec of the image.
+char*
+sect(uint sec)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
-    exit(1);
-  }
+  assert(sec < fssize);
+  return img + (uint64)sec * BSIZE;
 }
 
 void
-winode(uint inum, struct dinode *ip)
+wsect(uint sec, void *buf)
 {
-  char buf[BSIZE];
-  uint bn;
-  struct dinode *dip;
-
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *dip = *ip;
-  wsect(bn, buf);
+  memmove(sect(sec), buf, BSIZE);
 }
 
+// Write the used part of the image to fsfd, and size the
+// file to hold the rest.
 void
-rinode(uint inum, struct dinode *ip)
+writeimg(void)
 {
-  char buf[BSIZE];
-  uint bn;
-  struct dinode *dip;
+  uint64 n, len;
+  ssize_t cc;
 
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *ip = *dip;
-}
-
-void
-rsect(uint sec, void *buf)
-{
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
+  len = (uint64)freeblock * BSIZE;
+  for(n = 0; n < len; n += cc){
+    if((cc = write(fsfd, img + n, len - n)) <= 0){
+      perror("write");
+      exit(1);
+    }
   }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
+  if(ftruncate(fsfd, (off_t)fssize * BSIZE) < 0){
+    perror("ftruncate");
     exit(1);
   }
+  close(fsfd);
+}
+
+struct dinode*
+dinode(uint inum)
+{
+  return (struct dinode*)sect(IBLOCK(inum, sb)) + (inum % IPB);
 }
 
 uint
 ialloc(ushort type)
 {
   uint inum = freeinode++;
-  struct dinode din;
+  struct dinode *din;
 
-  bzero(&din, sizeof(din));
-  din.type = xshort(type);
-  din.nlink = xshort(1);
-  din.size = xint(0);
-  winode(inum, &din);
+  if(inum >= ninodes){
+    fprintf(stderr, "mkfs: out of inodes\n");
+    exit(1);
+  }
+  din = dinode(inum);
+  bzero(din, sizeof(*din));
+  din->type = xshort(type);
+  din->nlink = xshort(1);
+  din->size = xint(0);
   return inum;
 }
 
+uint
+newblock(void)
+{
+  if(freeblock >= fssize){
+    fprintf(stderr, "mkfs: out of blocks\n");
+    exit(1);
+  }
+  return xint(freeblock++);
+}
+
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
+  uchar *bits;
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
   for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    bits = (uchar*)sect(BBLOCK(i, sb));
+    bits[(i%BPB)/8] |= 0x1 << (i%8);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  printf("balloc: wrote bitmap blocks from sector %d\n", sb.bmapstart);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// The disk block holding block fbn of din, allocating it
+// and any indirect blocks on the way as needed.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint *a;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT){
+    if(din->addrs[fbn] == 0)
+      din->addrs[fbn] = newblock();
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+  if(fbn < NINDIRECT){
+    if(din->addrs[NDIRECT] == 0)
+      din->addrs[NDIRECT] = newblock();
+    a = (uint*)sect(xint(din->addrs[NDIRECT]));
+    if(a[fbn] == 0)
+      a[fbn] = newblock();
+    return xint(a[fbn]);
+  }
+  // double-indirect: an indirect block of indirect blocks.
+  fbn -= NINDIRECT;
+  if(din->addrs[NDIRECT+1] == 0)
+    din->addrs[NDIRECT+1] = newblock();
+  a = (uint*)sect(xint(din->addrs[NDIRECT+1]));
+  if(a[fbn / NINDIRECT] == 0)
+    a[fbn / NINDIRECT] = newblock();
+  a = (uint*)sect(xint(a[fbn / NINDIRECT]));
+  if(a[fbn % NINDIRECT] == 0)
+    a[fbn % NINDIRECT] = newblock();
+  return xint(a[fbn % NINDIRECT]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
-  struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  struct dinode *din;
 
-  rinode(inum, &din);
-  off = xint(din.size);
-  // printf("append inum %d at off %d sz %d\n", inum, off, n);
+  din = dinode(inum);
+  off = xint(din->size);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
     n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    memmove(sect(bmap(din, fbn)) + off - (fbn * BSIZE), p, n1);
     n -= n1;
     off += n1;
     p += n1;
   }
-  din.size = xint(off);
-  winode(inum, &din);
+  din->size = xint(off);
+}
+
+// Hash of a directory entry name; must match the kernel's
+// dirhash() in kernel/fs.c.
+uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+int
+direntcmp(const void *a, const void *b)
+{
+  uint ha = dirhash(((struct dirent*)a)->name);
+  uint hb = dirhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Write the n entries of directory inum: as plain dirents if
+// they fit in one block, otherwise as an index block and
+// half-full leaves, in the format dirlookup() expects.
+void
+dirappend(uint inum, struct dirent *de, int n)
+{
+  struct dirindex x[NDIRINDEX];
+  struct dirent leaf[DPB];
+  int i, j, nleaf;
+
+  if(n <= DPB){
+    iappend(inum, de, n * sizeof(*de));
+    return;
+  }
+
+  qsort(de, n, sizeof(*de), direntcmp);
+  bzero(x, sizeof(x));
+  nleaf = 0;
+  for(i = 0; i < n; i += j){
+    // names with equal hashes must share a leaf.
+    for(j = 1; i + j < n && (j < DPB/2 ||
+        dirhash(de[i+j].name) == dirhash(de[i+j-1].name)); j++)
+      assert(j < DPB);
+    assert(nleaf < NDIRINDEX);
+    x[nleaf].magic = xshort(DIRMAGIC);
+    x[nleaf].hash = xint(nleaf == 0 ? 0 : dirhash(de[i].name));
+    x[nleaf].bn = xint(nleaf + 1);
+    nleaf++;
+  }
+  iappend(inum, x, sizeof(x));
+
+  for(i = 0; i < n; i += j){
+    for(j = 1; i + j < n && (j < DPB/2 ||
+        dirhash(de[i+j].name) == dirhash(de[i+j-1].name)); j++)
+      ;
+    bzero(leaf, sizeof(leaf));
+    memmove(leaf, de + i, j * sizeof(*de));
+    iappend(inum, leaf, sizeof(leaf));
+  }
 }
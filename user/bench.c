@@ -0,0 +1,279 @@
+// Time the kernel and file system, and print one result
+// per line, for comparing kernels:
+//   bench <name> <value> <unit>
+// Times come from the time CSR, which ticks TIMEBASE times
+// a second on qemu's virt machine.
+//   bench [name ...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define TIMEBASE 10000000
+#define FILESIZE (512*1024)
+#define NFILES 100
+
+char buf[4096];
+
+struct sigaction {
+  void (*sa_handler)(int);
+  uint sigmask;
+};
+
+static inline uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("csrr %0, time" : "=r" (x) );
+  return x;
+}
+
+// nanoseconds for each of n operations that took t.
+void
+perop(char *name, uint64 t, int n)
+{
+  printf("bench %s %l ns\n", name, t * (1000000000 / TIMEBASE) / n);
+}
+
+// KB per second, for n bytes that took t.
+void
+rate(char *name, uint64 t, uint64 n)
+{
+  if(t == 0)
+    t = 1;
+  printf("bench %s %l KB/s\n", name, n * TIMEBASE / t / 1024);
+}
+
+void
+fail(char *what)
+{
+  printf("bench: %s failed\n", what);
+  exit(1);
+}
+
+uint seed = 1;
+
+uint
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+// a round trip into the kernel and back.
+void
+syscalls(void)
+{
+  int i, n = 10000;
+  uint mask;
+  uint64 t;
+
+  mask = sigprocmask(0);
+  t = rdtime();
+  for(i = 0; i < n; i++)
+    sigprocmask(mask);
+  perop("syscall", rdtime() - t, n);
+}
+
+void
+forkwait(void)
+{
+  int i, pid, n = 200;
+  uint64 t;
+
+  t = rdtime();
+  for(i = 0; i < n; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  perop("fork", rdtime() - t, n);
+}
+
+void
+forkexec(void)
+{
+  char *argv[] = { "bench", "-exit", 0 };
+  int i, pid, n = 50;
+  uint64 t;
+
+  t = rdtime();
+  for(i = 0; i < n; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      exec("bench", argv);
+      fail("exec");
+    }
+    wait(0);
+  }
+  perop("exec", rdtime() - t, n);
+}
+
+void
+pipethroughput(void)
+{
+  int fds[2], pid, n, total = 4*1024*1024;
+  uint64 t, got;
+
+  if(pipe(fds) < 0)
+    fail("pipe");
+  t = rdtime();
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(fds[0]);
+    for(n = 0; n < total; n += sizeof(buf))
+      if(write(fds[1], buf, sizeof(buf)) != sizeof(buf))
+        fail("pipe write");
+    exit(0);
+  }
+  close(fds[1]);
+  got = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    got += n;
+  t = rdtime() - t;
+  close(fds[0]);
+  wait(0);
+  if(got != total)
+    fail("pipe read");
+  rate("pipe", t, got);
+}
+
+// sequential, then random, writes and reads of one file.
+void
+files(void)
+{
+  int fd, i, n;
+  uint64 t;
+
+  if((fd = open("bench.tmp", O_CREATE|O_TRUNC|O_RDWR)) < 0)
+    fail("open");
+  t = rdtime();
+  for(i = 0; i < FILESIZE; i += sizeof(buf))
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      fail("write");
+  rate("seqwrite", rdtime() - t, FILESIZE);
+  close(fd);
+
+  if((fd = open("bench.tmp", O_RDWR)) < 0)
+    fail("open");
+  t = rdtime();
+  for(i = 0; i < FILESIZE; i += sizeof(buf))
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf))
+      fail("read");
+  rate("seqread", rdtime() - t, FILESIZE);
+
+  n = 1000;
+  t = rdtime();
+  for(i = 0; i < n; i++)
+    if(pread(fd, buf, BSIZE, rnd() % (FILESIZE / BSIZE) * BSIZE) != BSIZE)
+      fail("pread");
+  perop("randread", rdtime() - t, n);
+
+  t = rdtime();
+  for(i = 0; i < n; i++)
+    if(pwrite(fd, buf, BSIZE, rnd() % (FILESIZE / BSIZE) * BSIZE) != BSIZE)
+      fail("pwrite");
+  perop("randwrite", rdtime() - t, n);
+  close(fd);
+  unlink("bench.tmp");
+}
+
+void
+createunlink(void)
+{
+  char name[8];
+  int i, fd;
+  uint64 t;
+
+  strcpy(name, "bf00");
+  t = rdtime();
+  for(i = 0; i < NFILES; i++){
+    name[2] = '0' + i / 10;
+    name[3] = '0' + i % 10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+      fail("create");
+    close(fd);
+  }
+  perop("create", rdtime() - t, NFILES);
+
+  t = rdtime();
+  for(i = 0; i < NFILES; i++){
+    name[2] = '0' + i / 10;
+    name[3] = '0' + i % 10;
+    if(unlink(name) < 0)
+      fail("unlink");
+  }
+  perop("unlink", rdtime() - t, NFILES);
+}
+
+volatile int signalled;
+
+void
+handler(int signum)
+{
+  signalled++;
+}
+
+// the kernel reads the handler from here when it runs it.
+struct sigaction sigact = { handler, 0 };
+
+// kill() of ourselves, through the handler and back.
+void
+signals(void)
+{
+  int i, n = 1000;
+  uint64 t;
+
+  if(sigaction(5, &sigact, 0) < 0)
+    fail("sigaction");
+  signalled = 0;
+  t = rdtime();
+  for(i = 0; i < n; i++)
+    kill(getpid(), 5);
+  t = rdtime() - t;
+  if(signalled != n)
+    fail("signal");
+  perop("signal", t, n);
+}
+
+struct test {
+  void (*f)(void);
+  char *name;
+} tests[] = {
+  {syscalls, "syscall"},
+  {forkwait, "fork"},
+  {forkexec, "exec"},
+  {pipethroughput, "pipe"},
+  {files, "file"},
+  {createunlink, "create"},
+  {signals, "signal"},
+  {0, 0},
+};
+
+int
+main(int argc, char *argv[])
+{
+  struct test *t;
+  int i;
+
+  if(argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit(0);
+
+  for(t = tests; t->f; t++){
+    if(argc > 1){
+      for(i = 1; i < argc; i++)
+        if(strcmp(argv[i], t->name) == 0)
+          break;
+      if(i == argc)
+        continue;
+    }
+    t->f();
+  }
+  exit(0);
+}
@@ -1,42 +1,232 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// A pattern with no operators is searched for directly in
+// each buffer of input, so lines without it cost almost
+// nothing. Other patterns of up to MAXATOM characters are
+// compiled into a bit-parallel NFA that looks at each input
+// character once; longer ones use the backtracking matcher
+// at the end of this file.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[1024];
+#define MAXATOM 63
+
+char buf[32768];
 int match(char*, char*);
 
+// the compiled pattern. state i means the first i atoms
+// have matched; state natom is a match.
+struct {
+  int natom;
+  int bol;               // ^: only at the start of a line
+  int eol;               // $: only at the end of one
+  uint64 star;           // atoms followed by *
+  uint64 start;          // states before any input
+  uint64 next[256];      // atoms that each character matches
+} nfa;
+
+char *literal;           // the pattern, if it has no operators
+int literallen;
+
+// matching lines not yet written: buf[outstart, outend).
+char *outstart, *outend;
+
+void
+output(char *line, char *end)
+{
+  if(line != outend){
+    if(outend > outstart)
+      write(1, outstart, outend - outstart);
+    outstart = line;
+  }
+  outend = end;
+}
+
+void
+outputflush(void)
+{
+  if(outend > outstart)
+    write(1, outstart, outend - outstart);
+  outstart = outend = 0;
+}
+
+// add the states reachable by skipping starred atoms.
+uint64
+closure(uint64 s)
+{
+  uint64 t;
+
+  do{
+    t = s;
+    s |= (s & nfa.star) << 1;
+  }while(s != t);
+  return s;
+}
+
+// Compile re into nfa, or return -1 if it is too long.
+int
+compile(char *re)
+{
+  int c, n;
+
+  memset(&nfa, 0, sizeof(nfa));
+  if(*re == '^'){
+    nfa.bol = 1;
+    re++;
+  }
+  for(n = 0; *re; re++){
+    if(re[0] == '$' && re[1] == '\0'){
+      nfa.eol = 1;
+      break;
+    }
+    if(n == MAXATOM)
+      return -1;
+    if(re[1] == '*')
+      nfa.star |= 1L << n;
+    for(c = 1; c < 256; c++){
+      if(re[0] == '.' || re[0] == c)
+        nfa.next[c] |= 1L << n;
+    }
+    n++;
+    if(re[1] == '*')
+      re++;
+  }
+  nfa.natom = n;
+  nfa.start = closure(1);
+  return 0;
+}
+
+// Write the lines from p to e that match. The last one
+// ends in a newline.
+void
+scannfa(char *p, char *e)
+{
+  uint64 s, t, x, accept;
+  char *line;
+
+  accept = 1L << nfa.natom;
+  line = p;
+  s = nfa.start;
+  for(; p < e; p++){
+    if(*p == '\n'){
+      if(s & accept)
+        output(line, p + 1);
+      line = p + 1;
+      s = nfa.start;
+      continue;
+    }
+    if((s & accept) && !nfa.eol){
+      // matched already; skip to the end of the line.
+      while(*p != '\n')
+        p++;
+      output(line, p + 1);
+      line = p + 1;
+      s = nfa.start;
+      continue;
+    }
+    x = s & nfa.next[(uchar)*p];
+    t = closure((x & nfa.star) | ((x & ~nfa.star) << 1));
+    if(!nfa.bol)
+      t |= nfa.start;
+    s = t;
+    if(s == 0){
+      // anchored, and can't match: skip the line.
+      while(*p != '\n')
+        p++;
+      line = p + 1;
+      s = nfa.start;
+    }
+  }
+}
+
+// Same, for a pattern with no operators: look for it
+// across the whole buffer, not line by line.
 void
-grep(char *pattern, int fd)
+scanliteral(char *p, char *e)
+{
+  char *line, *end;
+  char c = literal[0];
+
+  while(p + literallen <= e){
+    if(*p != c || memcmp(p, literal, literallen) != 0){
+      p++;
+      continue;
+    }
+    for(line = p; line > buf && line[-1] != '\n'; line--)
+      ;
+    for(end = p; *end != '\n'; end++)
+      ;
+    output(line, end + 1);
+    p = end + 1;
+  }
+}
+
+// The backtracking matcher, one line at a time.
+void
+scanslow(char *pattern, char *p, char *e)
+{
+  char *q;
+
+  for(; p < e; p = q + 1){
+    q = strchr(p, '\n');
+    *q = 0;
+    if(match(pattern, p))
+      output(p, q + 1);
+    *q = '\n';
+  }
+}
+
+void
+scan(char *pattern, char *e, int compiled)
+{
+  if(literal)
+    scanliteral(buf, e);
+  else if(compiled)
+    scannfa(buf, e);
+  else
+    scanslow(pattern, buf, e);
+  outputflush();
+}
+
+void
+grep(char *pattern, int fd, int compiled)
 {
   int n, m;
-  char *p, *q;
+  char *e;
 
   m = 0;
   while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
     m += n;
     buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+    // scan the complete lines; a line that fills the
+    // whole buffer is taken as it is.
+    for(e = buf + m; e > buf && e[-1] != '\n'; e--)
+      ;
+    if(e == buf){
+      if(m < sizeof(buf) - 1)
+        continue;
+      buf[m] = '\n';
+      e = buf + m + 1;
     }
+    scan(pattern, e, compiled);
+    m -= e - buf;
+    if(m < 0)
+      m = 0;
+    memmove(buf, e, m);
+  }
+  // a last line without a newline.
+  if(m > 0){
+    buf[m] = '\n';
+    scan(pattern, buf + m + 1, compiled);
   }
 }
 
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, compiled;
   char *pattern;
 
   if(argc <= 1){
@@ -45,8 +235,18 @@ main(int argc, char *argv[])
   }
   pattern = argv[1];
 
+  literal = pattern;
+  for(i = 0; pattern[i]; i++){
+    if(strchr("^.*$", pattern[i]))
+      literal = 0;
+  }
+  literallen = i;
+  if(literallen == 0)
+    literal = 0;
+  compiled = (literal == 0 && compile(pattern) == 0);
+
   if(argc <= 2){
-    grep(pattern, 0);
+    grep(pattern, 0, compiled);
     exit(0);
   }
 
@@ -55,7 +255,7 @@ main(int argc, char *argv[])
       printf("grep: cannot open %s\n", argv[i]);
       exit(1);
     }
-    grep(pattern, fd);
+    grep(pattern, fd, compiled);
     close(fd);
   }
   exit(0);
@@ -102,4 +302,3 @@ int matchstar(int c, char *re, char *text)
   }while(*text!='\0' && (*text++==c || c=='.'));
   return 0;
 }
-
@@ -0,0 +1,88 @@
+// Print the kernel's spinlock statistics, most contended
+// first. With a command, print what changed while it ran
+// (the longest hold is still the longest since boot).
+//   lockstat [-n top] [command args...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+struct lockstat before[NLOCKSTAT], after[NLOCKSTAT];
+
+int
+get(struct lockstat *ls)
+{
+  int n;
+
+  if((n = lockstat(ls, NLOCKSTAT)) < 0){
+    fprintf(2, "lockstat: lockstat failed\n");
+    exit(1);
+  }
+  return n < NLOCKSTAT ? n : NLOCKSTAT;
+}
+
+// sort by contended acquisitions, then spins.
+int
+more(struct lockstat *a, struct lockstat *b)
+{
+  if(a->ncontend != b->ncontend)
+    return a->ncontend > b->ncontend;
+  return a->nspin > b->nspin;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, nb, top, pid;
+  struct lockstat t;
+
+  top = 10;
+  if(argc > 2 && strcmp(argv[1], "-n") == 0){
+    top = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
+  nb = 0;
+  if(argc > 1){
+    nb = get(before);
+    if((pid = fork()) < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  n = get(after);
+  if(n == 0){
+    fprintf(2, "lockstat: no statistics; build the kernel with LOCKSTAT=1\n");
+    exit(1);
+  }
+
+  // entries only get added, in order, so before[i] and
+  // after[i] are the same lock name.
+  for(i = 0; i < nb; i++){
+    after[i].nacquire -= before[i].nacquire;
+    after[i].ncontend -= before[i].ncontend;
+    after[i].nspin -= before[i].nspin;
+  }
+
+  for(i = 1; i < n; i++){
+    t = after[i];
+    for(j = i; j > 0 && more(&t, &after[j-1]); j--)
+      after[j] = after[j-1];
+    after[j] = t;
+  }
+
+  printf("%s\t%s\t%s\t%s\t%s\n", "name", "acquire", "contend", "spin", "maxhold");
+  for(i = 0; i < n && i < top; i++){
+    printf("%s\t%l\t%l\t%l\t%l\n", after[i].name, after[i].nacquire,
+           after[i].ncontend, after[i].nspin, after[i].maxhold);
+  }
+  exit(0);
+}
@@ -0,0 +1,125 @@
+// Compare the word-at-a-time memset(), memmove() and
+// memcmp() in ulib.c with plain byte loops, and check
+// that they agree. Times are in clock ticks.
+//   membench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define N 8192
+
+char a[N+16], b[N+16];
+
+void
+bytememset(char *d, int c, uint n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+void
+bytememmove(char *d, const char *s, uint n)
+{
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+int
+bytememcmp(const char *p, const char *q, uint n)
+{
+  while(n-- > 0){
+    if(*p != *q)
+      return *p - *q;
+    p++, q++;
+  }
+  return 0;
+}
+
+// fill a with a pattern, and check a few alignments
+// and lengths against the byte versions.
+void
+check(void)
+{
+  int off, n, i;
+
+  for(i = 0; i < N+16; i++)
+    a[i] = i * 7;
+  for(off = 0; off < 8; off++){
+    for(n = 0; n < 40; n++){
+      memmove(b + 3, a + off, n);
+      if(bytememcmp(b + 3, a + off, n) != 0 || memcmp(b + 3, a + off, n) != 0){
+        printf("membench: memmove off %d n %d wrong\n", off, n);
+        exit(1);
+      }
+      memset(b + off, 'x', n);
+      for(i = 0; i < n; i++)
+        if(b[off + i] != 'x'){
+          printf("membench: memset off %d n %d wrong\n", off, n);
+          exit(1);
+        }
+    }
+  }
+  // overlapping moves, both ways.
+  for(i = 0; i < 200; i++)
+    a[i] = i;
+  memmove(a + 8, a, 100);
+  for(i = 0; i < 100; i++)
+    if(a[i + 8] != (char)i){
+      printf("membench: overlapping memmove wrong\n");
+      exit(1);
+    }
+  for(i = 0; i < 200; i++)
+    a[i] = i;
+  memmove(a, a + 9, 100);
+  for(i = 0; i < 100; i++)
+    if(a[i] != (char)(i + 9)){
+      printf("membench: overlapping memmove wrong\n");
+      exit(1);
+    }
+  a[N-1] = 1;
+  b[N-1] = 2;
+  if(memcmp(a, b, N) >= 0 || memcmp(b, a, N) <= 0){
+    printf("membench: memcmp wrong\n");
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 2000, i, t;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  check();
+
+  t = uptime();
+  for(i = 0; i < rounds; i++)
+    bytememset(a, i, N);
+  printf("memset   bytes %d ", uptime() - t);
+  t = uptime();
+  for(i = 0; i < rounds; i++)
+    memset(a, i, N);
+  printf("words %d\n", uptime() - t);
+
+  t = uptime();
+  for(i = 0; i < rounds; i++)
+    bytememmove(b, a, N);
+  printf("memmove  bytes %d ", uptime() - t);
+  t = uptime();
+  for(i = 0; i < rounds; i++)
+    memmove(b, a, N);
+  printf("words %d\n", uptime() - t);
+
+  t = uptime();
+  for(i = 0; i < rounds; i++)
+    bytememcmp(a, b, N);
+  printf("memcmp   bytes %d ", uptime() - t);
+  t = uptime();
+  for(i = 0; i < rounds; i++)
+    memcmp(a, b, N);
+  printf("words %d\n", uptime() - t);
+
+  exit(0);
+}
@@ -0,0 +1,58 @@
+// Run a command at a nice level: positive levels get less
+// cpu time, negative ones more. -q also sets its quantum,
+// the clock ticks it runs before yielding to other work;
+// a long quantum suits batch jobs. With -p, change a
+// running process instead.
+//   nice [-q quantum] level command args...
+//   nice -p pid [-q quantum] level
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// atoi(), but levels can be negative.
+int
+level(char *s)
+{
+  if(*s == '-')
+    return -atoi(s+1);
+  return atoi(s);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pid, q;
+
+  pid = -1;
+  if(argc > 2 && strcmp(argv[1], "-p") == 0){
+    pid = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  q = 0;
+  if(argc > 2 && strcmp(argv[1], "-q") == 0){
+    q = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < (pid >= 0 ? 2 : 3)){
+    fprintf(2, "usage: nice [-q quantum] level command args...\n");
+    fprintf(2, "       nice -p pid [-q quantum] level\n");
+    exit(1);
+  }
+
+  if(pid >= 0){
+    if(nice(pid, level(argv[1])) < 0 || (q && quantum(pid, q) < 0)){
+      fprintf(2, "nice: no process %d\n", pid);
+      exit(1);
+    }
+    exit(0);
+  }
+  nice(0, level(argv[1]));
+  if(q)
+    quantum(0, q);
+  exec(argv[2], argv+2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -6,14 +6,147 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// Each printf() collects its output in a struct out, and
+// hands it on a buffer at a time, so a line costs one
+// write() rather than one per character. Output for fd 1
+// is held further, in stdout: until a newline if fd 1 is
+// the console, otherwise until the buffer fills. fflush(1)
+// writes it, as do fork(), exec(), exit() and close(1) (see
+// ulib.c). Other fds get each printf() as it finishes.
+
+struct out {
+  int fd;
+  int n;
+  char buf[128];
+};
+
+#define LINEBUF 1
+#define FULLBUF 2
+
+static struct {
+  int lock;       // thread id of the thread adding to buf, or 0
+  int mode;       // LINEBUF or FULLBUF, or 0 before the first write
+  int n;
+  char buf[512];
+} stdout;
+
+extern void (*stdoutflush)(void);
+
+// The kernel starts each thread with its thread id in tp,
+// and signal handlers run on the thread they interrupt.
+static int
+mytid(void)
+{
+  uint64 x;
+  asm volatile("mv %0, tp" : "=r" (x));
+  return x;
+}
+
+// Take stdout.lock, waiting for another thread that holds
+// it. If this thread holds it already, this is a signal
+// handler that interrupted the holder, which won't run
+// again until the handler returns; return 0 instead of
+// waiting.
+static int
+stdoutlock(void)
+{
+  int tid = mytid(), holder, i;
+
+  for(i = 0; ; i++){
+    if((holder = __sync_val_compare_and_swap(&stdout.lock, 0, tid)) == 0)
+      return 1;
+    if(holder == tid)
+      return 0;
+    if(i >= 100)
+      sleep(1);
+  }
+}
+
+static void
+stdoutunlock(void)
+{
+  __sync_lock_release(&stdout.lock);
+}
+
+// Caller holds stdout.lock.
+static void
+stdoutwrite(void)
+{
+  if(stdout.n > 0)
+    write(1, stdout.buf, stdout.n);
+  stdout.n = 0;
+}
+
+static void
+flushall(void)
+{
+  fflush(1);
+}
+
+void
+fflush(int fd)
+{
+  if(fd != 1 || !stdoutlock())
+    return;
+  stdoutwrite();
+  stdoutunlock();
+}
+
+// Add n bytes to stdout.
+static void
+stdoutadd(char *buf, int n)
+{
+  struct stat st;
+  int i, nl;
+
+  if(!stdoutlock()){
+    write(1, buf, n);
+    return;
+  }
+  if(stdout.mode == 0){
+    stdout.mode = (fstat(1, &st) == 0 && st.type == T_DEVICE) ? LINEBUF : FULLBUF;
+    stdoutflush = flushall;
+  }
+  if(stdout.n + n > sizeof(stdout.buf))
+    stdoutwrite();
+  if(n > sizeof(stdout.buf)){
+    write(1, buf, n);
+  } else {
+    memmove(stdout.buf + stdout.n, buf, n);
+    stdout.n += n;
+  }
+  if(stdout.mode == LINEBUF){
+    nl = 0;
+    for(i = 0; i < n; i++)
+      nl |= (buf[i] == '\n');
+    if(nl)
+      stdoutwrite();
+  }
+  stdoutunlock();
+}
+
+static void
+outflush(struct out *o)
+{
+  if(o->n == 0)
+    return;
+  if(o->fd == 1)
+    stdoutadd(o->buf, o->n);
+  else
+    write(o->fd, o->buf, o->n);
+  o->n = 0;
+}
+
 static void
-putc(int fd, char c)
+putc(struct out *o, char c)
 {
-  write(fd, &c, 1);
+  if(o->n == sizeof(o->buf))
+    outflush(o);
+  o->buf[o->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct out *o, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,25 +168,28 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(o, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(struct out *o, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(o, '0');
+  putc(o, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(o, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
+  struct out out, *o = &out;
   char *s;
   int c, i, state;
 
+  o->fd = fd;
+  o->n = 0;
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -61,37 +197,38 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(o, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(o, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(o, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(o, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(o, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(o, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(o, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(o, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(o, '%');
+        putc(o, c);
       }
       state = 0;
     }
   }
+  outflush(o);
 }
 
 void
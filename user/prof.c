@@ -0,0 +1,225 @@
+// Profile a command: sample the pc it is at on each clock
+// interrupt, then print the functions it was found in most,
+// looked up in the command's ELF symbol table. Time it spent
+// in the kernel is listed by pc; look those up on the host
+// with addr2line -f -e kernel/kernel.
+//   prof [-n top] command args...
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/elf.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+#define NKPC 256
+
+struct func {
+  uint64 lo, hi;
+  char *name;
+  int n;
+};
+
+struct kpc {
+  uint64 pc;
+  int n;
+};
+
+struct profsample samples[NPROF];
+struct func *funcs;
+int nfunc;
+struct kpc kpcs[NKPC];
+int nkpc;
+
+// Read the function symbols of ELF file path into funcs.
+// The names point into the file, which stays in memory.
+void
+loadsyms(char *path)
+{
+  int fd, i, n;
+  struct stat st;
+  char *buf, *strtab;
+  struct elfhdr *eh;
+  struct secthdr *sh, *symsh;
+  struct elfsym *sym;
+  struct func *f;
+
+  if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    fprintf(2, "prof: cannot open %s\n", path);
+    return;
+  }
+  buf = malloc(st.size);
+  n = read(fd, buf, st.size);
+  close(fd);
+  eh = (struct elfhdr*)buf;
+  if(n != st.size || eh->magic != ELF_MAGIC ||
+     eh->shoff + eh->shnum*sizeof(struct secthdr) > st.size){
+    fprintf(2, "prof: %s is not an ELF file\n", path);
+    return;
+  }
+
+  sh = (struct secthdr*)(buf + eh->shoff);
+  symsh = 0;
+  for(i = 0; i < eh->shnum; i++){
+    if(sh[i].type == ELF_SHT_SYMTAB)
+      symsh = &sh[i];
+  }
+  if(symsh == 0 || symsh->link >= eh->shnum){
+    fprintf(2, "prof: %s has no symbols\n", path);
+    return;
+  }
+  strtab = buf + sh[symsh->link].off;
+  sym = (struct elfsym*)(buf + symsh->off);
+  n = symsh->size / sizeof(struct elfsym);
+  funcs = malloc(n * sizeof(struct func));
+  for(i = 0; i < n; i++){
+    if(ELF_ST_TYPE(sym[i].info) != ELF_STT_FUNC)
+      continue;
+    f = &funcs[nfunc++];
+    f->lo = sym[i].value;
+    f->hi = sym[i].value + sym[i].size;
+    f->name = strtab + sym[i].name;
+    f->n = 0;
+  }
+}
+
+struct func*
+findfunc(uint64 pc)
+{
+  int i;
+
+  for(i = 0; i < nfunc; i++){
+    if(pc >= funcs[i].lo && pc < funcs[i].hi)
+      return &funcs[i];
+  }
+  return 0;
+}
+
+// Count a kernel sample. Returns 0 if the table is full.
+int
+addkpc(uint64 pc)
+{
+  int i;
+
+  for(i = 0; i < nkpc; i++){
+    if(kpcs[i].pc == pc){
+      kpcs[i].n++;
+      return 1;
+    }
+  }
+  if(nkpc == NKPC)
+    return 0;
+  kpcs[nkpc].pc = pc;
+  kpcs[nkpc++].n = 1;
+  return 1;
+}
+
+void
+sortfuncs(void)
+{
+  int i, j;
+  struct func t;
+
+  for(i = 1; i < nfunc; i++){
+    t = funcs[i];
+    for(j = i; j > 0 && t.n > funcs[j-1].n; j--)
+      funcs[j] = funcs[j-1];
+    funcs[j] = t;
+  }
+}
+
+void
+sortkpcs(void)
+{
+  int i, j;
+  struct kpc t;
+
+  for(i = 1; i < nkpc; i++){
+    t = kpcs[i];
+    for(j = i; j > 0 && t.n > kpcs[j-1].n; j--)
+      kpcs[j] = kpcs[j-1];
+    kpcs[j] = t;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, top, pid, dropped, nuser, nunknown, nkern, kother;
+  int fds[2];
+  struct func *f;
+  char c;
+
+  top = 10;
+  if(argc > 2 && strcmp(argv[1], "-n") == 0){
+    top = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < 2){
+    fprintf(2, "usage: prof [-n top] command args...\n");
+    exit(1);
+  }
+
+  // the child waits until profiling is on before exec.
+  if(pipe(fds) < 0 || (pid = fork()) < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    close(fds[0]);
+    exec(argv[1], argv+1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  close(fds[0]);
+  if(profctl(pid) < 0){
+    fprintf(2, "prof: profctl failed\n");
+    kill(pid, SIGKILL);
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  close(fds[1]);
+  wait(0);
+  dropped = profctl(0);
+  n = profread(samples, NPROF);
+
+  loadsyms(argv[1]);
+  nuser = nunknown = nkern = kother = 0;
+  for(i = 0; i < n; i++){
+    if(samples[i].user){
+      nuser++;
+      if((f = findfunc(samples[i].pc)) != 0)
+        f->n++;
+      else
+        nunknown++;
+    } else {
+      nkern++;
+      if(addkpc(samples[i].pc) == 0)
+        kother++;
+    }
+  }
+  if(n == 0){
+    printf("prof: no samples\n");
+    exit(0);
+  }
+
+  printf("%d samples: %d user, %d kernel, %d dropped\n", n, nuser, nkern, dropped);
+  sortfuncs();
+  printf("%s\t%s\t%s\n", "count", "pct", "function");
+  for(i = 0; i < nfunc && i < top && funcs[i].n > 0; i++)
+    printf("%d\t%d%%\t%s\n", funcs[i].n, funcs[i].n*100/n, funcs[i].name);
+  if(nunknown)
+    printf("%d\t%d%%\t%s\n", nunknown, nunknown*100/n, "?");
+
+  sortkpcs();
+  if(nkpc)
+    printf("%s\t%s\t%s\n", "count", "pct", "kernel pc");
+  for(i = 0; i < nkpc && i < top; i++)
+    printf("%d\t%d%%\t%p\n", kpcs[i].n, kpcs[i].n*100/n, kpcs[i].pc);
+  if(kother)
+    printf("%d\t%d%%\t%s\n", kother, kother*100/n, "other");
+  exit(0);
+}
@@ -0,0 +1,131 @@
+// List processes with their scheduler counters: time spent
+// running and time spent RUNNABLE waiting for a cpu, in time
+// CSR ticks, and voluntary and involuntary context switches.
+// With -t, act like top: every interval clock ticks, list
+// the processes by how much cpu they used since the last
+// list, as a percentage of one cpu, busiest first.
+//   ps [-t interval] [-n top]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/procinfo.h"
+#include "user/user.h"
+
+struct procinfo prev[NPROC], cur[NPROC];
+int order[NPROC];
+uint64 drun[NPROC], dwait[NPROC];
+
+int
+get(struct procinfo *pi)
+{
+  int n;
+
+  if((n = getprocinfo(pi, NPROC)) < 0){
+    fprintf(2, "ps: getprocinfo failed\n");
+    exit(1);
+  }
+  return n;
+}
+
+void
+list(void)
+{
+  int i, n;
+  struct procinfo *pi;
+
+  n = get(cur);
+  printf("pid\tppid\tstate\tnice\tq\tcpu\tthr\tkb\trun\twait\tvcsw\tivcsw\tname\n");
+  for(i = 0; i < n; i++){
+    pi = &cur[i];
+    printf("%d\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%l\t%l\t%l\t%l\t%s\n", pi->pid, pi->ppid,
+           pi->state, pi->nice, pi->quantum, pi->cpu, pi->nthread,
+           (int)(pi->sz / 1024), pi->runtime, pi->waittime, pi->nvcsw,
+           pi->nivcsw, pi->name);
+  }
+}
+
+// The entry for pid in prev, or 0 if it is new.
+struct procinfo*
+find(int pid, int np)
+{
+  int i;
+
+  for(i = 0; i < np; i++){
+    if(prev[i].pid == pid)
+      return &prev[i];
+  }
+  return 0;
+}
+
+void
+top(int interval, int ntop)
+{
+  int i, j, n, np, t, dt, o;
+  struct procinfo *pi, *pp;
+
+  np = get(prev);
+  t = uptime();
+  for(;;){
+    sleep(interval);
+    n = get(cur);
+    dt = uptime() - t;
+    t += dt;
+    if(dt == 0)
+      dt = 1;
+
+    for(i = 0; i < n; i++){
+      drun[i] = cur[i].runtime;
+      dwait[i] = cur[i].waittime;
+      if((pp = find(cur[i].pid, np)) != 0 && pp->runtime <= cur[i].runtime){
+        drun[i] -= pp->runtime;
+        dwait[i] -= pp->waittime;
+      }
+      o = i;
+      for(j = i; j > 0 && drun[o] > drun[order[j-1]]; j--)
+        order[j] = order[j-1];
+      order[j] = o;
+    }
+
+    printf("\npid\tstate\tcpu\t%%cpu\twait\tname\n");
+    for(i = 0; i < n && i < ntop; i++){
+      pi = &cur[order[i]];
+      printf("%d\t%s\t%d\t%d\t%l\t%s\n", pi->pid, pi->state, pi->cpu,
+             (int)(drun[order[i]] * 100 / ((uint64)dt * TIMER_INTERVAL)),
+             dwait[order[i]], pi->name);
+    }
+
+    memmove(prev, cur, n * sizeof(struct procinfo));
+    np = n;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int interval, ntop;
+
+  interval = 0;
+  ntop = NPROC;
+  while(argc > 2){
+    if(strcmp(argv[1], "-t") == 0)
+      interval = atoi(argv[2]);
+    else if(strcmp(argv[1], "-n") == 0)
+      ntop = atoi(argv[2]);
+    else
+      break;
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc > 1){
+    fprintf(2, "usage: ps [-t interval] [-n top]\n");
+    exit(1);
+  }
+
+  if(interval > 0)
+    top(interval, ntop);
+  else
+    list();
+  exit(0);
+}
@@ -12,6 +12,7 @@
 #define BACK  5
 
 #define MAXARGS 10
+#define MAXREDIR 4  // redirections of a builtin command
 
 struct cmd {
   int type;
@@ -52,16 +53,16 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void runpipe(struct cmd*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
 {
-  int p[2];
   struct backcmd *bcmd;
   struct execcmd *ecmd;
   struct listcmd *lcmd;
-  struct pipecmd *pcmd;
   struct redircmd *rcmd;
 
   if(cmd == 0)
@@ -98,27 +99,7 @@ runcmd(struct cmd *cmd)
     break;
 
   case PIPE:
-    pcmd = (struct pipecmd*)cmd;
-    if(pipe(p) < 0)
-      panic("pipe");
-    if(fork1() == 0){
-      close(1);
-      dup(p[1]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->left);
-    }
-    if(fork1() == 0){
-      close(0);
-      dup(p[0]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->right);
-    }
-    close(p[0]);
-    close(p[1]);
-    wait(0);
-    wait(0);
+    runpipe(cmd);
     break;
 
   case BACK:
@@ -130,6 +111,203 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Fork a child to run one stage of a pipeline, with in
+// and out, unless -1, as its standard input and output.
+// The child closes other, the read end of the next pipe.
+void
+runstage(struct cmd *cmd, int in, int out, int other)
+{
+  if(fork1() == 0){
+    if(in >= 0){
+      close(0);
+      dup(in);
+      close(in);
+    }
+    if(out >= 0){
+      close(1);
+      dup(out);
+      close(out);
+    }
+    if(other >= 0)
+      close(other);
+    runcmd(cmd);
+  }
+}
+
+// Run a pipeline with one child per stage, all started
+// before any is waited for.
+void
+runpipe(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+  int p[2], in, n;
+
+  in = -1;
+  for(n = 0; cmd->type == PIPE; n++){
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      break;
+    }
+    runstage(pcmd->left, in, p[1], p[0]);
+    if(in >= 0)
+      close(in);
+    close(p[1]);
+    in = p[0];
+    cmd = pcmd->right;
+  }
+  if(cmd->type != PIPE){
+    runstage(cmd, in, -1, -1);
+    n++;
+  }
+  if(in >= 0)
+    close(in);
+  while(n-- > 0)
+    wait(0);
+}
+
+//PAGEBREAK!
+// Builtins, run by the shell itself to save a fork()
+// and exec().
+
+int
+docd(int argc, char **argv)
+{
+  if(argc != 2 || chdir(argv[1]) < 0){
+    fprintf(2, "cannot cd %s\n", argc > 1 ? argv[1] : "");
+    return 1;
+  }
+  return 0;
+}
+
+int
+doecho(int argc, char **argv)
+{
+  int i;
+
+  for(i = 1; i < argc; i++){
+    write(1, argv[i], strlen(argv[i]));
+    if(i + 1 < argc){
+      write(1, " ", 1);
+    } else {
+      write(1, "\n", 1);
+    }
+  }
+  return 0;
+}
+
+int
+domkdir(int argc, char **argv)
+{
+  int i;
+
+  if(argc < 2){
+    fprintf(2, "Usage: mkdir files...\n");
+    return 1;
+  }
+  for(i = 1; i < argc; i++){
+    if(mkdir(argv[i]) < 0){
+      fprintf(2, "mkdir: %s failed to create\n", argv[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int
+dorm(int argc, char **argv)
+{
+  int i;
+
+  if(argc < 2){
+    fprintf(2, "Usage: rm files...\n");
+    return 1;
+  }
+  for(i = 1; i < argc; i++){
+    if(unlink(argv[i]) < 0){
+      fprintf(2, "rm: %s failed to delete\n", argv[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int
+doln(int argc, char **argv)
+{
+  if(argc != 3){
+    fprintf(2, "Usage: ln old new\n");
+    return 1;
+  }
+  if(link(argv[1], argv[2]) < 0){
+    fprintf(2, "link %s %s: failed\n", argv[1], argv[2]);
+    return 1;
+  }
+  return 0;
+}
+
+struct builtin {
+  char *name;
+  int (*f)(int, char**);
+} builtins[] = {
+  {"cd", docd},
+  {"echo", doecho},
+  {"mkdir", domkdir},
+  {"rm", dorm},
+  {"ln", doln},
+  {0, 0},
+};
+
+// Run cmd in the shell itself if it is a builtin, with
+// any redirections undone afterwards. Returns 0 if cmd
+// needs a child instead.
+int
+runbuiltin(struct cmd *cmd)
+{
+  struct redircmd *rcmd[MAXREDIR];
+  struct execcmd *ecmd;
+  struct builtin *b;
+  int saved[MAXREDIR], argc, n, i;
+
+  for(n = 0; cmd->type == REDIR; n++){
+    if(n == MAXREDIR)
+      return 0;
+    rcmd[n] = (struct redircmd*)cmd;
+    cmd = rcmd[n]->cmd;
+  }
+  if(cmd->type != EXEC)
+    return 0;
+  ecmd = (struct execcmd*)cmd;
+  if(ecmd->argv[0] == 0)
+    return n == 0;
+  for(b = builtins; b->name; b++)
+    if(strcmp(ecmd->argv[0], b->name) == 0)
+      break;
+  if(b->name == 0)
+    return 0;
+  for(argc = 0; ecmd->argv[argc]; argc++)
+    ;
+
+  // as runcmd() does, outermost first.
+  for(i = 0; i < n; i++){
+    saved[i] = dup(rcmd[i]->fd);
+    close(rcmd[i]->fd);
+    if(open(rcmd[i]->file, rcmd[i]->mode) < 0){
+      fprintf(2, "open %s failed\n", rcmd[i]->file);
+      i++;
+      break;
+    }
+  }
+  if(i == n)
+    b->f(argc, ecmd->argv);
+  while(i-- > 0){
+    close(rcmd[i]->fd);
+    dup(saved[i]);
+    close(saved[i]);
+  }
+  return 1;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,6 +323,7 @@ int
 main(void)
 {
   static char buf[100];
+  struct cmd *cmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -156,17 +335,20 @@ main(void)
   }
 
   // Read and run input commands.
+  // A pipeline needs no child of its own to wait for its
+  // stages, and builtins (such as cd, which must change
+  // the shell's own directory) need none at all.
   while(getcmd(buf, sizeof(buf)) >= 0){
-    if(buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' '){
-      // Chdir must be called by the parent, not the child.
-      buf[strlen(buf)-1] = 0;  // chop \n
-      if(chdir(buf+3) < 0)
-        fprintf(2, "cannot cd %s\n", buf+3);
+    if((cmd = parsecmd(buf)) == 0)
       continue;
+    if(cmd->type == PIPE){
+      runpipe(cmd);
+    } else if(!runbuiltin(cmd)){
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -256,12 +438,50 @@ backcmd(struct cmd *subcmd)
   cmd->cmd = subcmd;
   return (struct cmd*)cmd;
 }
+
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
 //PAGEBREAK!
 // Parsing
 
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
 
+// The shell parses commands itself, so a syntax error
+// mustn't exit. syntax() reports the first one, and the
+// parse carries on as best it can before parsecmd()
+// gives up on the line.
+int parseerr;
+
+void
+syntax(char *s)
+{
+  if(!parseerr)
+    fprintf(2, "%s\n", s);
+  parseerr = 1;
+}
+
 int
 gettoken(char **ps, char *es, char **q, char **eq)
 {
@@ -330,12 +550,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +604,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +632,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +660,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc + 1 >= MAXARGS){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
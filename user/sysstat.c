@@ -0,0 +1,126 @@
+// Print the kernel's system call statistics: calls, total
+// and mean time in time CSR ticks, and, system-wide, each
+// call's log2 latency histogram. With a command, print the
+// system-wide change while it ran; with -p, just what
+// process pid has done.
+//   sysstat [-p pid] [command args...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/syscall.h"
+#include "kernel/sysstat.h"
+#include "user/user.h"
+
+char *names[NSYSCALL] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_sigprocmask] "sigprocmask",
+[SYS_sigaction] "sigaction",
+[SYS_sigret]  "sigret",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_thread_exit] "thread_exit",
+[SYS_lockstat] "lockstat",
+[SYS_getstats] "getstats",
+[SYS_profctl] "profctl",
+[SYS_profread] "profread",
+[SYS_getprocinfo] "getprocinfo",
+[SYS_nice]    "nice",
+[SYS_quantum] "quantum",
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_shmget]  "shmget",
+[SYS_shmat]   "shmat",
+[SYS_shmdt]   "shmdt",
+[SYS_poll]    "poll",
+[SYS_pipe2]   "pipe2",
+[SYS_fcntl]   "fcntl",
+[SYS_sendfile] "sendfile",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_uring_setup] "uring_setup",
+[SYS_uring_enter] "uring_enter",
+};
+
+struct sysstat before[NSYSCALL], st[NSYSCALL];
+
+void
+get(int pid, struct sysstat *st)
+{
+  if(getstats(pid, st, NSYSCALL) < 0){
+    fprintf(2, "sysstat: no process %d\n", pid);
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, b, pid;
+
+  pid = 0;
+  if(argc > 2 && strcmp(argv[1], "-p") == 0){
+    pid = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
+  if(pid == 0 && argc > 1){
+    get(0, before);
+    if((i = fork()) < 0){
+      fprintf(2, "sysstat: fork failed\n");
+      exit(1);
+    }
+    if(i == 0){
+      exec(argv[1], argv+1);
+      fprintf(2, "sysstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  get(pid, st);
+  for(i = 0; i < NSYSCALL; i++){
+    st[i].ncall -= before[i].ncall;
+    st[i].time -= before[i].time;
+    for(b = 0; b < NSYSHIST; b++)
+      st[i].hist[b] -= before[i].hist[b];
+  }
+
+  printf("%s\t%s\t%s\t%s\n", "call", "count", "time", "mean");
+  for(i = 0; i < NSYSCALL; i++){
+    if(st[i].ncall == 0)
+      continue;
+    printf("%s\t%l\t%l\t%l\n", names[i] ? names[i] : "?", st[i].ncall,
+           st[i].time, st[i].time / st[i].ncall);
+    if(pid != 0)
+      continue;
+    printf("\t");
+    for(b = 0; b < NSYSHIST; b++)
+      if(st[i].hist[b])
+        printf(" 2^%d:%l", b, st[i].hist[b]);
+    printf("\n");
+  }
+  exit(0);
+}
@@ -1,8 +1,58 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
 #include "user/user.h"
 
+// the system calls that the wrappers below call.
+int _fork(void);
+int _exec(char*, char**);
+int _close(int);
+
+// set by printf.c once it holds output for fd 1, so that
+// the wrappers write it first: a forked child mustn't print
+// it again, and exec() or exit() mustn't lose it. Programs
+// linked without printf.o (forktest) leave it 0.
+void (*stdoutflush)(void);
+
+static void
+flushout(void)
+{
+  if(stdoutflush)
+    stdoutflush();
+}
+
+int
+fork(void)
+{
+  flushout();
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  flushout();
+  _exit(status);
+}
+
+int
+exec(char *path, char **argv)
+{
+  flushout();
+  return _exec(path, argv);
+}
+
+int
+close(int fd)
+{
+  if(fd == 1)
+    flushout();
+  return _close(fd);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -32,14 +82,25 @@ strlen(const char *s)
   return n;
 }
 
+// memset(), memmove() and memcmp() go a 64-bit word at a
+// time when the addresses have the same alignment.
+#define WSIZE sizeof(uint64)
+#define ALIGNED(p) (((uint64)(p) % WSIZE) == 0)
+#define COALIGNED(p, q) ((((uint64)(p) ^ (uint64)(q)) % WSIZE) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
-  }
+  uint64 w, *wdst;
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+  w = (uchar)c * 0x0101010101010101UL;
+  for(wdst = (uint64*)cdst; n >= WSIZE; n -= WSIZE)
+    *wdst++ = w;
+  for(cdst = (char*)wdst; n > 0; n--)
+    *cdst++ = c;
   return dst;
 }
 
@@ -58,6 +119,7 @@ gets(char *buf, int max)
   int i, cc;
   char c;
 
+  flushout();  // a prompt
   for(i=0; i+1 < max; ){
     cc = read(0, &c, 1);
     if(cc < 1)
@@ -104,11 +166,26 @@ memmove(void *vdst, const void *vsrc, int n)
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    if(COALIGNED(src, dst)){
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *dst++ = *src++;
+      for(; n >= WSIZE; n -= WSIZE, dst += WSIZE, src += WSIZE)
+        *(uint64*)dst = *(const uint64*)src;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(COALIGNED(src, dst)){
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *--dst = *--src;
+      for(; n >= WSIZE; n -= WSIZE){
+        dst -= WSIZE;
+        src -= WSIZE;
+        *(uint64*)dst = *(const uint64*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -119,6 +196,13 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if(COALIGNED(p1, p2)){
+    for(; n > 0 && !ALIGNED(p1); n--, p1++, p2++)
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    for(; n >= WSIZE && *(uint64*)p1 == *(uint64*)p2; n -= WSIZE)
+      p1 += WSIZE, p2 += WSIZE;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -134,3 +218,26 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// getpid() and uptime() read the pages the kernel maps
+// at UPROC and USHARED, so they needn't trap.
+int
+getpid(void)
+{
+  return ((volatile struct vproc*)UPROC)->pid;
+}
+
+int
+uptime(void)
+{
+  volatile struct vdso *v = (volatile struct vdso*)USHARED;
+  uint seq, t;
+
+  do {
+    seq = v->seq;
+    __sync_synchronize();
+    t = v->ticks;
+    __sync_synchronize();
+  } while((seq & 1) || seq != v->seq);
+  return t;
+}
@@ -4,7 +4,16 @@
 #include "kernel/param.h"
 
 // Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// The C programming Language, 2nd ed.  Section 8.7,
+// with bins in front of it for small blocks.
+//
+// A request of up to NBIN units (header included) is served
+// from bins[nunits], a list of free blocks of exactly that
+// size, and freed back onto it, both in constant time. An
+// empty bin is filled by carving a chunk from the first-fit
+// free list into blocks of its size. Larger requests use the
+// first-fit list, which coalesces neighbours when they are
+// freed.
 
 typedef long Align;
 
@@ -18,15 +27,20 @@ union header {
 
 typedef union header Header;
 
+#define NBIN    32    // largest block, in units, kept in a bin
+#define BINFILL 256   // units carved at a time to fill a bin
+
 static Header base;
 static Header *freep;
+static Header *bins[NBIN+1];
 
-void
-free(void *ap)
+// Put bp on the first-fit list, merging it with its
+// neighbours.
+static void
+bigfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -43,6 +57,22 @@ free(void *ap)
   freep = p;
 }
 
+void
+free(void *ap)
+{
+  Header *bp;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.size <= NBIN){
+    bp->s.ptr = bins[bp->s.size];
+    bins[bp->s.size] = bp;
+    return;
+  }
+  bigfree(bp);
+}
+
 static Header*
 morecore(uint nu)
 {
@@ -56,17 +86,16 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  bigfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+// Take a block of nunits units from the first-fit list.
+static Header*
+bigalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +110,52 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
-      return (void*)(p + 1);
+      return p;
     }
     if(p == freep)
       if((p = morecore(nunits)) == 0)
         return 0;
   }
 }
+
+// Carve a chunk into free blocks of nunits units for
+// bins[nunits]. The blocks never go back to the first-fit
+// list.
+static void
+binfill(uint nunits)
+{
+  Header *p, *q;
+  uint n;
+
+  n = BINFILL / nunits;
+  if((p = bigalloc(n * nunits)) == 0){
+    n = 1;
+    if((p = bigalloc(nunits)) == 0)
+      return;
+  }
+  for(q = p; q < p + n * nunits; q += nunits){
+    q->s.size = nunits;
+    q->s.ptr = bins[nunits];
+    bins[nunits] = q;
+  }
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nunits <= NBIN){
+    if(bins[nunits] == 0)
+      binfill(nunits);
+    if((p = bins[nunits]) == 0)
+      return 0;
+    bins[nunits] = p->s.ptr;
+    return (void*)(p + 1);
+  }
+  if((p = bigalloc(nunits)) == 0)
+    return 0;
+  return (void*)(p + 1);
+}
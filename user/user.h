@@ -8,10 +8,18 @@
 struct stat;
 struct rtcdate;
 struct sigaction;
+struct lockstat;
+struct sysstat;
+struct pollfd;
+struct iovec;
+struct uring;
+struct profsample;
+struct procinfo;
 
 // system calls
 int fork(void);
 int exit(int) __attribute__((noreturn));
+int _exit(int) __attribute__((noreturn));  // without flushing printf()
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
@@ -34,6 +42,31 @@ int uptime(void);
 uint sigprocmask(uint);
 int sigaction(int, const struct sigaction*, struct sigaction*);
 void sigret(void);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int thread_exit(int) __attribute__((noreturn));
+int lockstat(struct lockstat*, int);
+int getstats(int, struct sysstat*, int);
+int profctl(int);
+int profread(struct profsample*, int);
+int getprocinfo(struct procinfo*, int);
+int nice(int, int);
+int quantum(int, int);
+void* mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int shmget(int, uint);
+void* shmat(int);
+int shmdt(void*);
+int poll(struct pollfd*, int, int);
+int pipe2(int*, int);
+int fcntl(int, int, int);
+int sendfile(int, int, uint*, int);
+int pread(int, void*, int, uint);
+int pwrite(int, const void*, int, uint);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+struct uring* uring_setup(void);
+int uring_enter(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -43,6 +76,7 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
+void fflush(int);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
@@ -7,6 +7,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/procinfo.h"
+#include "kernel/poll.h"
+#include "kernel/uio.h"
+#include "kernel/uring.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -865,6 +869,86 @@ preempt(char *s)
   wait(0);
 }
 
+// what getprocinfo() says about pid, or 0 if it isn't there.
+struct procinfo*
+procinfo(int pid)
+{
+  static struct procinfo pi[NPROC];
+  int i, n;
+
+  n = getprocinfo(pi, NPROC);
+  for(i = 0; i < n; i++){
+    if(pi[i].pid == pid)
+      return &pi[i];
+  }
+  return 0;
+}
+
+// the nice level a process reports, or 100 if it isn't there.
+int
+nicelevel(int pid)
+{
+  struct procinfo *pi;
+
+  return (pi = procinfo(pid)) ? pi->nice : 100;
+}
+
+// nice() sets and clamps levels, and children inherit them.
+void
+nicetest(char *s)
+{
+  int pid, xstatus;
+
+  if(nice(0, 5) < 0 || nicelevel(getpid()) != 5){
+    printf("%s: nice 5 failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(nicelevel(getpid()) != 5)
+      exit(1);
+    nice(0, 1000);
+    exit(nicelevel(getpid()) == 19 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child nice level wrong\n", s);
+    exit(1);
+  }
+  if(nice(999999, 0) != -1){
+    printf("%s: nice of a missing pid succeeded\n", s);
+    exit(1);
+  }
+  nice(0, -1000);
+  if(nicelevel(getpid()) != -20){
+    printf("%s: nice -1000 not clamped\n", s);
+    exit(1);
+  }
+  nice(0, 0);
+}
+
+// quantum() sets and clamps a process's time slice.
+void
+quantumtest(char *s)
+{
+  if(quantum(0, 1000) < 0 || procinfo(getpid())->quantum != MAXQUANTUM){
+    printf("%s: quantum 1000 not clamped\n", s);
+    exit(1);
+  }
+  if(quantum(0, 0) < 0 || procinfo(getpid())->quantum != 1){
+    printf("%s: quantum 0 not clamped\n", s);
+    exit(1);
+  }
+  if(quantum(999999, 5) != -1){
+    printf("%s: quantum of a missing pid succeeded\n", s);
+    exit(1);
+  }
+}
+
 // try to find any races between exit and wait
 void
 exitwait(char *s)
@@ -893,6 +977,795 @@ exitwait(char *s)
   }
 }
 
+// fork a process that uses more than half of physical
+// memory, which only fits if fork() shares pages
+// copy-on-write, and check that stores stay private.
+void
+cowfork(char *s)
+{
+  int sz = 70*1024*1024;
+  int pid, xstate;
+  char *p, *a;
+
+  p = sbrk(sz);
+  if(p == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(a = p; a < p + sz; a += 4096)
+    *(int*)a = 1;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(a = p; a < p + sz; a += 4096 * 64)
+      *(int*)a = 2;
+    exit(0);
+  }
+  if(wait(&xstate) != pid || xstate != 0){
+    printf("%s: child failed\n", s);
+    exit(1);
+  }
+  for(a = p; a < p + sz; a += 4096){
+    if(*(int*)a != 1){
+      printf("%s: child's store was visible to the parent\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-sz);
+}
+
+// read-only data lives on text pages, which processes
+// running the same program share; a store to one must
+// go to a private copy.
+static const char textmsg[] = "shared text";
+
+void
+textcow(char *s)
+{
+  volatile char *p = (volatile char*)textmsg;
+  int pid, xstate;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 'X';
+    exit(p[0] == 'X' ? 0 : 1);
+  }
+  if(wait(&xstate) != pid || xstate != 0){
+    printf("%s: child's store to text failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 's'){
+    printf("%s: child's store to text was visible to the parent\n", s);
+    exit(1);
+  }
+}
+
+// mmap(): a private mapping reads the file, a shared one
+// writes back on munmap(), anonymous shared memory is
+// shared with a forked child, and unmapped pages fault.
+void
+mmaptest(char *s)
+{
+  char *file = "mmaptest.tmp";
+  char buf[PGSIZE], *p;
+  int fd, i, pid, xstate;
+
+  for(i = 0; i < PGSIZE; i++)
+    buf[i] = 'a' + i % 26;
+  fd = open(file, O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, PGSIZE) != PGSIZE || write(fd, buf, 100) != 100){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, PGSIZE+100, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 'a' || p[PGSIZE+99] != buf[99] || p[PGSIZE+100] != 0){
+    printf("%s: private mapping has wrong contents\n", s);
+    exit(1);
+  }
+  p[0] = 'X';
+  if(munmap(p, PGSIZE+100) < 0){
+    printf("%s: munmap private failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  p[1] = 'Y';
+  p[PGSIZE+1] = 'Z';
+  p[PGSIZE+200] = 'W';
+  if(munmap(p, 2*PGSIZE) < 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  fd = open(file, O_RDONLY);
+  if(read(fd, buf, PGSIZE) != PGSIZE || buf[0] != 'a' || buf[1] != 'Y' ||
+     read(fd, buf, PGSIZE) != 100 || buf[1] != 'Z'){
+    printf("%s: shared stores weren't written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(file);
+
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED){
+    printf("%s: mmap anonymous failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 'C';
+    exit(0);
+  }
+  wait(0);
+  if(p[0] != 'C'){
+    printf("%s: child's store to shared memory not seen\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 'D';
+    exit(0);
+  }
+  if(wait(&xstate) != pid || xstate != -1){
+    printf("%s: store to unmapped memory didn't fault\n", s);
+    exit(1);
+  }
+}
+
+// shmget() by key finds the same segment in another process,
+// whose stores through its own attachment are seen, and
+// shmdt() unmaps the segment.
+void
+shmtest(char *s)
+{
+  int id, pid, xstate;
+  char *p, *q;
+
+  if((id = shmget(4242, 2*PGSIZE)) < 0){
+    printf("%s: shmget failed\n", s);
+    exit(1);
+  }
+  if(shmget(4242, 3*PGSIZE) >= 0){
+    printf("%s: shmget of a larger size succeeded\n", s);
+    exit(1);
+  }
+  p = shmat(id);
+  if(p == MAP_FAILED){
+    printf("%s: shmat failed\n", s);
+    exit(1);
+  }
+  p[0] = 'P';
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(shmdt(p) < 0)
+      exit(1);
+    q = shmat(shmget(4242, PGSIZE));
+    if(q == MAP_FAILED || q[0] != 'P')
+      exit(1);
+    q[PGSIZE] = 'C';
+    exit(0);
+  }
+  if(wait(&xstate) != pid || xstate != 0){
+    printf("%s: child couldn't attach the segment\n", s);
+    exit(1);
+  }
+  if(p[PGSIZE] != 'C'){
+    printf("%s: child's store wasn't seen\n", s);
+    exit(1);
+  }
+  if(shmdt(p+PGSIZE) >= 0 || shmdt(p) < 0){
+    printf("%s: shmdt failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 'D';
+    exit(0);
+  }
+  if(wait(&xstate) != pid || xstate != -1){
+    printf("%s: store to a detached segment didn't fault\n", s);
+    exit(1);
+  }
+}
+
+// poll() reports which of two pipes is readable, times out,
+// sleeps until a child writes to either, and sees hangups.
+void
+polltest(char *s)
+{
+  int a[2], b[2], pid, n;
+  struct pollfd fds[3];
+  char c;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = b[0];
+  fds[1].events = POLLIN;
+  fds[2].fd = a[1];
+  fds[2].events = POLLOUT;
+  if(poll(fds, 2, 0) != 0 || poll(fds, 2, 2) != 0){
+    printf("%s: poll of empty pipes didn't time out\n", s);
+    exit(1);
+  }
+  if(poll(fds, 3, -1) != 1 || fds[2].revents != POLLOUT){
+    printf("%s: pipe should be writable\n", s);
+    exit(1);
+  }
+
+  write(b[1], "x", 1);
+  if(poll(fds, 2, 0) != 1 || fds[0].revents != 0 || fds[1].revents != POLLIN){
+    printf("%s: poll didn't see the readable pipe\n", s);
+    exit(1);
+  }
+  read(b[0], &c, 1);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(3);
+    write(a[1], "y", 1);
+    exit(0);
+  }
+  n = poll(fds, 2, 1000);
+  wait(0);
+  if(n != 1 || fds[0].revents != POLLIN){
+    printf("%s: poll didn't wake for the child's write\n", s);
+    exit(1);
+  }
+  read(a[0], &c, 1);
+
+  close(b[1]);
+  if(poll(fds, 2, -1) != 1 || (fds[1].revents & POLLHUP) == 0){
+    printf("%s: poll didn't see the hangup\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  fds[0].fd = a[0];
+  if(poll(fds, 1, 0) != 1 || fds[0].revents != POLLNVAL){
+    printf("%s: poll of a closed fd\n", s);
+    exit(1);
+  }
+}
+
+// O_NONBLOCK pipe reads and writes return -EAGAIN instead of
+// sleeping, and fcntl() reads and clears the flag.
+void
+nonblocktest(char *s)
+{
+  int fds[2], n, tot;
+  char buf[512];
+
+  if(pipe2(fds, O_NONBLOCK) < 0){
+    printf("%s: pipe2 failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, 1) != -EAGAIN){
+    printf("%s: read of an empty pipe didn't return -EAGAIN\n", s);
+    exit(1);
+  }
+  tot = 0;
+  while((n = write(fds[1], buf, sizeof(buf))) > 0)
+    tot += n;
+  if(n != -EAGAIN || tot < sizeof(buf)){
+    printf("%s: write to a full pipe returned %d after %d\n", s, n, tot);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_GETFL, 0) != O_NONBLOCK || fcntl(fds[0], F_SETFL, 0) < 0 ||
+     fcntl(fds[0], F_GETFL, 0) != 0){
+    printf("%s: fcntl failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    tot -= n;
+  if(n != 0 || tot != 0){
+    printf("%s: reads didn't get the data back\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+}
+
+// sendfile() copies between files, from an offset or the
+// file's own, and from a file into a pipe.
+void
+sendfiletest(char *s)
+{
+  int in, out, fds[2], i, n;
+  uint off;
+  static char buf[3*BSIZE];
+
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i % 251;
+  in = open("sendfile.in", O_CREATE|O_RDWR);
+  out = open("sendfile.out", O_CREATE|O_RDWR);
+  if(in < 0 || out < 0 || write(in, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+
+  off = 10;
+  if(sendfile(out, in, &off, sizeof(buf)) != sizeof(buf) - 10 || off != sizeof(buf)){
+    printf("%s: sendfile between files failed\n", s);
+    exit(1);
+  }
+  // in's own offset is still at the end of what was written.
+  if(sendfile(out, in, 0, 1) != 0){
+    printf("%s: sendfile past the end didn't return 0\n", s);
+    exit(1);
+  }
+  close(out);
+  out = open("sendfile.out", O_RDONLY);
+  memset(buf, 0, sizeof(buf));
+  if(read(out, buf, sizeof(buf)) != sizeof(buf) - 10){
+    printf("%s: copy has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf) - 10; i++){
+    if(buf[i] != (char)((i + 10) % 251)){
+      printf("%s: copy is wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  off = 0;
+  if(sendfile(fds[1], in, &off, 100) != 100 || (n = read(fds[0], buf, 100)) != 100 ||
+     buf[99] != 99){
+    printf("%s: sendfile to a pipe failed\n", s);
+    exit(1);
+  }
+  if(sendfile(in, fds[0], 0, 1) >= 0){
+    printf("%s: sendfile from a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(in);
+  close(out);
+  unlink("sendfile.in");
+  unlink("sendfile.out");
+}
+
+// pread() and pwrite() leave the file offset alone, and
+// writev() and readv() gather and scatter in order.
+void
+preadvtest(char *s)
+{
+  int fd;
+  char a[8], b[8], c[8];
+  struct iovec iov[3];
+
+  fd = open("preadv.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  iov[0].base = "abc";
+  iov[0].len = 3;
+  iov[1].base = "";
+  iov[1].len = 0;
+  iov[2].base = "defgh";
+  iov[2].len = 5;
+  if(writev(fd, iov, 3) != 8){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "XY", 2, 3) != 2 || pread(fd, a, 4, 2) != 4 || memcmp(a, "cXYf", 4) != 0){
+    printf("%s: pread/pwrite failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "!", 1) != 1 || pread(fd, a, 8, 8) != 1 || a[0] != '!'){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  if(write(fd, a, -1) != -1 || read(fd, a, -1) != -1){
+    printf("%s: negative count accepted\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("preadv.tmp", O_RDONLY);
+  iov[0].base = a;
+  iov[0].len = 2;
+  iov[1].base = b;
+  iov[1].len = 4;
+  iov[2].base = c;
+  iov[2].len = 8;
+  if(readv(fd, iov, 3) != 9 || memcmp(a, "ab", 2) != 0 || memcmp(b, "cXYf", 4) != 0 ||
+     memcmp(c, "gh!", 3) != 0){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(pread(0, a, 1, 0) >= 0){
+    printf("%s: pread of the console succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("preadv.tmp");
+}
+
+// Queue an operation on r.
+void
+uringsub(struct uring *r, int op, int fd, void *addr, int n, uint off)
+{
+  struct usqe *e = &r->sq[r->sqtail % URING_ENTRIES];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->off = off;
+  e->data = r->sqtail;
+  r->sqtail++;
+}
+
+// a batch of open, write, pwrite, read and close through
+// the ring runs in one uring_enter(), in order.
+void
+uringtest(char *s)
+{
+  struct uring *r;
+  struct ucqe *c;
+  char buf[8];
+  int fd, i;
+
+  r = uring_setup();
+  if(r == (struct uring*)-1){
+    printf("%s: uring_setup failed\n", s);
+    exit(1);
+  }
+  if(uring_setup() != (struct uring*)-1){
+    printf("%s: second uring_setup succeeded\n", s);
+    exit(1);
+  }
+  fd = open("uring.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  uringsub(r, UOP_WRITE, fd, "hello", 5, 0);
+  uringsub(r, UOP_PWRITE, fd, "J", 1, 0);
+  uringsub(r, UOP_CLOSE, fd, 0, 0, 0);
+  uringsub(r, UOP_OPEN, 0, "uring.tmp", O_RDONLY, 0);
+  uringsub(r, UOP_NOP, 0, 0, 0, 0);
+  if(uring_enter(URING_ENTRIES) != 5 || r->sqhead != r->sqtail || r->cqtail != 5){
+    printf("%s: uring_enter didn't run the batch\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 5; i++){
+    c = &r->cq[i];
+    if(c->data != i || c->res != (i == 0 ? 5 : i == 1 ? 1 : i == 3 ? fd : 0)){
+      printf("%s: completion %d has res %d\n", s, i, c->res);
+      exit(1);
+    }
+  }
+  r->cqhead = r->cqtail;
+
+  uringsub(r, UOP_PREAD, fd, buf, sizeof(buf), 1);
+  uringsub(r, UOP_READ, 99, buf, 1, 0);
+  if(uring_enter(2) != 2 || r->cq[5].res != 4 || memcmp(buf, "ello", 4) != 0 ||
+     r->cq[6].res != -1){
+    printf("%s: pread through the ring failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("uring.tmp");
+}
+
+// getpid() and uptime() read pages the kernel maps
+// read-only, which follow fork() and the clock, and which
+// neither user code nor system calls may write.
+void
+vdsotest(char *s)
+{
+  int pid, xstate, fds[2], gds[2], t;
+
+  t = uptime();
+  sleep(2);
+  if(uptime() < t + 2){
+    printf("%s: uptime() didn't advance\n", s);
+    exit(1);
+  }
+
+  if(pipe(fds) < 0 || pipe(gds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    t = getpid();
+    write(fds[1], &t, sizeof(t));
+    // a read() into the shared page mustn't write it.
+    write(gds[1], "xxxx", 4);
+    read(gds[0], (char*)USHARED, 4);
+    if(*(volatile uint*)USHARED == 0x78787878)
+      exit(2);
+    *(volatile int*)UPROC = 0;
+    exit(0);
+  }
+  if(wait(&xstate) != pid || xstate != -1){
+    printf("%s: store to UPROC didn't fault (%d)\n", s, xstate);
+    exit(1);
+  }
+  if(read(fds[0], &t, sizeof(t)) != sizeof(t) || t != pid){
+    printf("%s: child's getpid() was %d, not %d\n", s, t, pid);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(gds[0]);
+  close(gds[1]);
+}
+
+struct sigaction {
+  void (*sa_handler)(int);
+  uint sigmask;
+};
+
+volatile int signalled;
+
+void
+sighandler(int signum)
+{
+  signalled += signum;
+}
+
+// the kernel reads the handler from here when it runs it.
+struct sigaction sigact = { sighandler, 0 };
+
+// user handlers return through the SIGTRAMP page, with the
+// interrupted registers restored.
+void
+sigframetest(char *s)
+{
+  int pid, xstate, i, r;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(sigaction(5, &sigact, 0) < 0)
+      exit(2);
+    for(i = 0; i < 100; i++){
+      // the handler runs on the way back from kill().
+      r = kill(getpid(), 5);
+      if(r != 0 || signalled != 5 * (i + 1))
+        exit(3);
+    }
+    *(volatile int*)SIGTRAMP = 0;
+    exit(0);
+  }
+  if(wait(&xstate) != pid || xstate != -1){
+    printf("%s: handler or store to SIGTRAMP went wrong (%d)\n", s, xstate);
+    exit(1);
+  }
+}
+
+// more descriptors than fit in the first table, lowest
+// free fd first, and inherited by fork().
+void
+manyfds(char *s)
+{
+  int fd, i, pid, xstate;
+  char c;
+
+  fd = open("manyfds", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf("%s: open manyfds failed\n", s);
+    exit(1);
+  }
+  for(i = fd + 1; i < 100; i++){
+    if(dup(fd) != i){
+      printf("%s: dup didn't return %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(10);
+  close(60);
+  if(dup(fd) != 10 || dup(fd) != 60){
+    printf("%s: dup didn't reuse the lowest free fd\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(pread(99, &c, 1, 0) != 1 || c != 'x')
+      exit(1);
+    exit(0);
+  }
+  if(wait(&xstate) != pid || xstate != 0){
+    printf("%s: child couldn't read fd 99\n", s);
+    exit(1);
+  }
+  for(i = fd; i < 100; i++)
+    close(i);
+  unlink("manyfds");
+}
+
+// sh runs a script with a pipeline, a syntax error it must
+// survive, and a builtin with its output redirected.
+void
+shscript(char *s)
+{
+  char *script = "echo a b | cat | cat > shout1\necho )\necho c > shout2\n";
+  char *argv[] = { "sh", 0 };
+  char buf[16];
+  int fd, pid, xstate, n;
+
+  fd = open("shscript", O_CREATE|O_WRONLY);
+  if(fd < 0 || write(fd, script, strlen(script)) != strlen(script)){
+    printf("%s: write shscript failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    close(2);
+    if(open("shscript", O_RDONLY) != 0 || open("shlog", O_CREATE|O_WRONLY) != 2)
+      exit(1);
+    exec("sh", argv);
+    exit(1);
+  }
+  if(wait(&xstate) != pid || xstate != 0){
+    printf("%s: sh failed\n", s);
+    exit(1);
+  }
+  fd = open("shout1", O_RDONLY);
+  if(fd < 0 || (n = read(fd, buf, sizeof(buf))) != 4 || memcmp(buf, "a b\n", 4) != 0){
+    printf("%s: pipeline output wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("shout2", O_RDONLY);
+  if(fd < 0 || (n = read(fd, buf, sizeof(buf))) != 2 || memcmp(buf, "c\n", 2) != 0){
+    printf("%s: sh didn't survive the syntax error\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("shscript");
+  unlink("shlog");
+  unlink("shout1");
+  unlink("shout2");
+}
+
+int threadval[NTHREAD];
+
+void
+threadworker(void *arg)
+{
+  int i = (int)(uint64)arg;
+
+  threadval[i] = i * 10;
+  thread_exit(i);
+}
+
+void
+threadspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// threads share memory with the thread that cloned
+// them, join() collects their exit status, and
+// exit() from any thread takes down all of them.
+void
+threadtest(char *s)
+{
+  int i, pid, xstate, tids[NTHREAD];
+  char *stacks;
+
+  stacks = malloc(NTHREAD * 4096);
+  if(stacks == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  for(i = 1; i < NTHREAD; i++){
+    tids[i] = clone(threadworker, (void*)(uint64)i, stacks + (i+1)*4096);
+    if(tids[i] < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  if(clone(threadworker, 0, stacks + 4096) >= 0){
+    printf("%s: clone beyond NTHREAD succeeded\n", s);
+    exit(1);
+  }
+  for(i = 1; i < NTHREAD; i++){
+    if(join(tids[i], &xstate) != 0 || xstate != i){
+      printf("%s: join wrong exit status\n", s);
+      exit(1);
+    }
+    if(threadval[i] != i * 10){
+      printf("%s: thread memory not shared\n", s);
+      exit(1);
+    }
+  }
+  if(join(tids[1], 0) != -1){
+    printf("%s: joined a thread twice\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 1; i < NTHREAD; i++)
+      clone(threadspin, 0, stacks + (i+1)*4096);
+    exit(7);
+  }
+  if(wait(&xstate) != pid || xstate != 7){
+    printf("%s: exit with threads running failed\n", s);
+    exit(1);
+  }
+  free(stacks);
+}
+
 // try to find races in the reparenting
 // code that handles a parent exiting
 // when it still has live children.
@@ -1553,6 +2426,63 @@ bigdir(char *s)
   }
 }
 
+// a directory big enough to be indexed, with a subdirectory
+// so that "." and ".." are not its first entries.
+void
+dirindex(char *s)
+{
+  enum { N = 1000 };
+  int i, fd;
+  char name[16];
+
+  if(mkdir("di") != 0){
+    printf("%s: mkdir di failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[0] = 'd'; name[1] = 'i'; name[2] = '/';
+    name[3] = 'f';
+    name[4] = '0' + (i / 100);
+    name[5] = '0' + (i / 10) % 10;
+    name[6] = '0' + (i % 10);
+    name[7] = '\0';
+    if(i == N/2){
+      if(mkdir(name) != 0){
+        printf("%s: mkdir %s failed\n", s, name);
+        exit(1);
+      }
+      continue;
+    }
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  if(open("di/absent", O_RDONLY) >= 0){
+    printf("%s: opened a name that is not there\n", s);
+    exit(1);
+  }
+  if(unlink("di") == 0){
+    printf("%s: unlinked a non-empty directory\n", s);
+    exit(1);
+  }
+  for(i = N-1; i >= 0; i--){
+    name[4] = '0' + (i / 100);
+    name[5] = '0' + (i / 10) % 10;
+    name[6] = '0' + (i % 10);
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("di") != 0){
+    printf("%s: unlink di failed\n", s);
+    exit(1);
+  }
+}
+
 void
 subdir(char *s)
 {
@@ -2818,7 +3748,23 @@ main(int argc, char *argv[])
     {pipe1, "pipe1"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
+    {nicetest, "nicetest"},
+    {quantumtest, "quantumtest"},
     {exitwait, "exitwait"},
+    {threadtest, "threadtest"},
+    {cowfork, "cowfork"},
+    {textcow, "textcow"},
+    {mmaptest, "mmaptest"},
+    {shmtest, "shmtest"},
+    {polltest, "polltest"},
+    {nonblocktest, "nonblocktest"},
+    {sendfiletest, "sendfiletest"},
+    {preadvtest, "preadvtest"},
+    {uringtest, "uringtest"},
+    {vdsotest, "vdsotest"},
+    {sigframetest, "sigframetest"},
+    {manyfds, "manyfds"},
+    {shscript, "shscript"},
     {rmdot, "rmdot"},
     {fourteen, "fourteen"},
     {bigfile, "bigfile"},
@@ -2826,6 +3772,7 @@ main(int argc, char *argv[])
     {iref, "iref"},
     {forktest, "forktest"},
     {bigdir, "bigdir"}, // slow
+    {dirindex, "dirindex"}, // slow
     { 0, 0},
   };
 
@@ -6,24 +6,26 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry("x", "_x") names the stub _x, for ulib.c to wrap.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $label = shift || $name;
+    print ".global $label\n";
+    print "${label}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
-entry("close");
+entry("close", "_close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -32,11 +34,34 @@ entry("link");
 entry("mkdir");
 entry("chdir");
 entry("dup");
-entry("getpid");
 entry("sbrk");
 entry("sleep");
-entry("uptime");
 entry("sigprocmask");
 entry("sigaction");
 entry("sigret");
+entry("clone");
+entry("join");
+entry("thread_exit");
+entry("lockstat");
+entry("getstats");
+entry("profctl");
+entry("profread");
+entry("getprocinfo");
+entry("nice");
+entry("quantum");
+entry("mmap");
+entry("munmap");
+entry("shmget");
+entry("shmat");
+entry("shmdt");
+entry("poll");
+entry("pipe2");
+entry("fcntl");
+entry("sendfile");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("uring_setup");
+entry("uring_enter");
 